@@ -35,12 +35,12 @@ private:
             return tb;
 
         std::vector<TextBox> child_tbs;
-        for (auto child : node.children)
+        for (const auto& child : node.children)
             child_tbs.push_back(create_tree_textbox(child));
         
         tb.vline(0, 1, 1);
         int i = 0;
-        for (auto child : child_tbs) {
+        for (const auto& child : child_tbs) {
             tb.vline(i, 2, 2);
             tb(i, 4) << child;
             i += child.width() + padding;
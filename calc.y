@@ -0,0 +1,17 @@
+/* Arithmetic with numbers and variables, lexed by patterns. */
+%token num /[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?/
+%token ident /[A-Za-z_][A-Za-z0-9_]*/
+%%
+expr : expr '+' term
+     | expr '-' term
+     | term
+     ;
+term : term '*' factor
+     | term '/' factor
+     | factor
+     ;
+factor : '(' expr ')'
+       | '-' factor
+       | num
+       | ident
+       ;
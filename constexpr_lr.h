@@ -0,0 +1,334 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// LALR(1) tables built by the compiler. A grammar is a type with the
+// productions as {lhs, rhs} pairs, rhs symbols separated by blanks and the
+// augmented start production first:
+//
+//     struct ETF {
+//         static constexpr std::string_view productions[][2] = {
+//             {"E'", "E"}, {"E", "E + T"}, {"E", "T"}, ...
+//         };
+//     };
+//
+// Names without productions are terminals. As in gen_lalr_main.cpp the
+// terminals come first (in order of appearance, then "$"), followed by the
+// nonterminals, and an action cell keeps its kind in the top two bits and
+// the shift state or production in the rest. lr_parser<ETF> then holds the
+// tables as constexpr arrays sized by the grammar.
+namespace lr {
+
+enum ActionKind : uint32_t { Error, Shift, Reduce, Accept };
+
+constexpr ActionKind kind(uint32_t action) {
+    return static_cast<ActionKind>(action >> 30);
+}
+
+constexpr int value(uint32_t action) {
+    return static_cast<int>(action & ((1u << 30) - 1));
+}
+
+namespace detail {
+
+struct Production {
+    int lhs;
+    std::vector<int> rhs;
+};
+
+struct Grammar {
+    std::vector<std::string_view> names;
+    int num_terminals = 0;
+    std::vector<Production> productions;
+    std::vector<uint64_t> first;   // FIRST of every symbol as a terminal bit set
+    std::vector<char> nullable;
+};
+
+// An LR(1) item with all its lookaheads as one bit set.
+struct Item {
+    int production;
+    int dot;
+    uint64_t lookahead;
+};
+
+struct State {
+    std::vector<Item> kernel;
+    std::vector<Item> items;
+    std::vector<int> next;
+};
+
+constexpr int find(const std::vector<std::string_view>& names, std::string_view name) {
+    for (int i = 0; i < names.size(); i++)
+        if (names[i] == name) return i;
+    return -1;
+}
+
+constexpr std::vector<std::string_view> split(std::string_view rhs) {
+    std::vector<std::string_view> names;
+    size_t i = 0;
+    while (i < rhs.size()) {
+        while (i < rhs.size() && (rhs[i] == ' ' || rhs[i] == '\t')) i++;
+        size_t j = i;
+        while (j < rhs.size() && rhs[j] != ' ' && rhs[j] != '\t') j++;
+        if (j > i) names.push_back(rhs.substr(i, j - i));
+        i = j;
+    }
+    return names;
+}
+
+template <class G>
+constexpr Grammar read_grammar() {
+    Grammar g;
+    std::vector<std::string_view> lhs_names;
+    for (auto& p : G::productions)
+        if (find(lhs_names, p[0]) == -1) lhs_names.push_back(p[0]);
+    for (auto& p : G::productions)
+        for (auto x : split(p[1]))
+            if (find(lhs_names, x) == -1 && find(g.names, x) == -1) g.names.push_back(x);
+    g.names.push_back("$");
+    g.num_terminals = g.names.size();
+    if (g.num_terminals > 64)
+        throw "lr_parser supports at most 64 terminals";
+    for (auto x : lhs_names)
+        g.names.push_back(x);
+
+    for (auto& p : G::productions) {
+        Production prod {find(g.names, p[0]), {}};
+        for (auto x : split(p[1]))
+            prod.rhs.push_back(find(g.names, x));
+        g.productions.push_back(prod);
+    }
+
+    g.first.assign(g.names.size(), 0);
+    g.nullable.assign(g.names.size(), false);
+    for (int t = 0; t < g.num_terminals; t++)
+        g.first[t] = uint64_t(1) << t;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& p : g.productions) {
+            bool all_nullable = true;
+            for (int x : p.rhs) {
+                if (g.first[x] & ~g.first[p.lhs]) {
+                    g.first[p.lhs] |= g.first[x];
+                    changed = true;
+                }
+                if (!g.nullable[x]) {
+                    all_nullable = false;
+                    break;
+                }
+            }
+            if (all_nullable && !g.nullable[p.lhs])
+                g.nullable[p.lhs] = changed = true;
+        }
+    }
+    return g;
+}
+
+constexpr std::vector<Item> closure(const Grammar& g, std::vector<Item> items) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < items.size(); i++) {
+            Item item = items[i];
+            const auto& rhs = g.productions[item.production].rhs;
+            if (item.dot == rhs.size() || rhs[item.dot] < g.num_terminals) continue;
+
+            // lookaheads of the new items: FIRST of what follows the
+            // nonterminal, plus the item's own if all of that is nullable
+            uint64_t lookahead = 0;
+            bool nullable = true;
+            for (size_t k = item.dot + 1; k < rhs.size() && nullable; k++) {
+                lookahead |= g.first[rhs[k]];
+                nullable = g.nullable[rhs[k]];
+            }
+            if (nullable) lookahead |= item.lookahead;
+
+            for (int p = 0; p < g.productions.size(); p++) {
+                if (g.productions[p].lhs != rhs[item.dot]) continue;
+                size_t j = 0;
+                while (j < items.size() && !(items[j].production == p && items[j].dot == 0)) j++;
+                if (j == items.size()) {
+                    items.push_back({p, 0, lookahead});
+                    changed = true;
+                } else if (lookahead & ~items[j].lookahead) {
+                    items[j].lookahead |= lookahead;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return items;
+}
+
+constexpr bool same_core(const std::vector<Item>& a, const std::vector<Item>& b) {
+    if (a.size() != b.size()) return false;
+    for (auto& x : a) {
+        bool found = false;
+        for (auto& y : b) found |= x.production == y.production && x.dot == y.dot;
+        if (!found) return false;
+    }
+    return true;
+}
+
+// LALR(1) states by lookahead propagation: states are found by their LR(0)
+// core, and whenever a transition brings new lookaheads into an existing
+// state its closure is redone, until nothing changes.
+constexpr std::vector<State> build_states(const Grammar& g) {
+    std::vector<State> states;
+    std::vector<Item> start {{0, 0, uint64_t(1) << (g.num_terminals - 1)}};
+    states.push_back({start, closure(g, start), {}});
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t s = 0; s < states.size(); s++) {
+            states[s].next.assign(g.names.size(), -1);
+            for (int x = 0; x < g.names.size(); x++) {
+                std::vector<Item> kernel;
+                for (auto& item : states[s].items) {
+                    const auto& rhs = g.productions[item.production].rhs;
+                    if (item.dot < rhs.size() && rhs[item.dot] == x)
+                        kernel.push_back({item.production, item.dot + 1, item.lookahead});
+                }
+                if (kernel.empty()) continue;
+
+                int t = 0;
+                while (t < states.size() && !same_core(states[t].kernel, kernel)) t++;
+                if (t == states.size()) {
+                    states.push_back({kernel, closure(g, kernel), {}});
+                    changed = true;
+                } else {
+                    bool grew = false;
+                    for (auto& k : kernel) {
+                        for (auto& tk : states[t].kernel) {
+                            if (tk.production == k.production && tk.dot == k.dot && (k.lookahead & ~tk.lookahead)) {
+                                tk.lookahead |= k.lookahead;
+                                grew = true;
+                            }
+                        }
+                    }
+                    if (grew) {
+                        states[t].items = closure(g, states[t].kernel);
+                        changed = true;
+                    }
+                }
+                states[s].next[x] = t;
+            }
+        }
+    }
+    return states;
+}
+
+struct Sizes {
+    int states;
+    int terminals;
+    int non_terminals;
+    int productions;
+};
+
+template <class G>
+constexpr Sizes sizes() {
+    Grammar g = read_grammar<G>();
+    int states = build_states(g).size();
+    return {states, g.num_terminals, static_cast<int>(g.names.size()) - g.num_terminals, static_cast<int>(g.productions.size())};
+}
+
+template <int S, int T, int N, int P>
+struct Tables {
+    std::array<std::array<uint32_t, T>, S> action {};
+    std::array<std::array<int32_t, N>, S> goto_table {};
+    std::array<int, P> production_len {};
+    std::array<int, P> production_lhs {};
+    std::array<std::string_view, T + N> symbol_names {};
+    int conflicts = 0;
+};
+
+template <class G, int S, int T, int N, int P>
+constexpr Tables<S, T, N, P> tables() {
+    Grammar g = read_grammar<G>();
+    std::vector<State> states = build_states(g);
+    Tables<S, T, N, P> tab;
+    for (int s = 0; s < S; s++) {
+        for (int t = 0; t < T; t++)
+            if (states[s].next[t] != -1) tab.action[s][t] = (Shift << 30) | states[s].next[t];
+        for (int n = 0; n < N; n++)
+            tab.goto_table[s][n] = states[s].next[T + n];
+        // reduce overrides shift, as in Grammar::action_map()
+        for (auto& item : states[s].items) {
+            if (item.dot != g.productions[item.production].rhs.size()) continue;
+            for (int t = 0; t < T; t++) {
+                if (!(item.lookahead >> t & 1)) continue;
+                uint32_t act = ((item.production == 0 ? Accept : Reduce) << 30) | item.production;
+                if (tab.action[s][t] != Error << 30 && tab.action[s][t] != act) tab.conflicts++;
+                tab.action[s][t] = act;
+            }
+        }
+    }
+    for (int p = 0; p < P; p++) {
+        tab.production_len[p] = g.productions[p].rhs.size();
+        tab.production_lhs[p] = g.productions[p].lhs - T;
+    }
+    for (int i = 0; i < T + N; i++)
+        tab.symbol_names[i] = g.names[i];
+    return tab;
+}
+
+} // namespace detail
+
+template <class G>
+struct lr_parser {
+    static constexpr detail::Sizes size = detail::sizes<G>();
+    static constexpr int num_states = size.states;
+    static constexpr int num_terminals = size.terminals;
+    static constexpr int num_non_terminals = size.non_terminals;
+    static constexpr int num_productions = size.productions;
+
+    static constexpr auto tables = detail::tables<G, num_states, num_terminals, num_non_terminals, num_productions>();
+    static_assert(tables.conflicts == 0, "grammar is not LALR(1)");
+
+    static constexpr const auto& action = tables.action;
+    static constexpr const auto& goto_table = tables.goto_table;
+    static constexpr const auto& production_len = tables.production_len;
+    static constexpr const auto& production_lhs = tables.production_lhs;
+    static constexpr const auto& symbol_names = tables.symbol_names;
+
+    // Symbol id of a name, -1 if the grammar has no such symbol.
+    static constexpr int symbol(std::string_view name) {
+        for (int i = 0; i < symbol_names.size(); i++)
+            if (symbol_names[i] == name) return i;
+        return -1;
+    }
+
+    // next() returns the next terminal (or -1 on a lexical error), on_reduce
+    // is called with every production reduced by.
+    template <class Next, class OnReduce>
+    static bool parse(Next&& next, OnReduce&& on_reduce) {
+        std::vector<int> stack {0};
+        int a = next();
+        while (true) {
+            if (a < 0 || a >= num_terminals) return false;
+            uint32_t act = action[stack.back()][a];
+            switch (kind(act)) {
+            case Shift:
+                stack.push_back(value(act));
+                a = next();
+                break;
+            case Reduce:
+                stack.resize(stack.size() - production_len[value(act)]);
+                if (goto_table[stack.back()][production_lhs[value(act)]] < 0) return false;
+                stack.push_back(goto_table[stack.back()][production_lhs[value(act)]]);
+                on_reduce(value(act));
+                break;
+            case Accept:
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+};
+
+} // namespace lr
@@ -0,0 +1,12 @@
+/* The expression grammar the generator used to hard-code. */
+%token id
+%%
+E : E '+' T
+  | T
+  ;
+T : T '*' F
+  | F
+  ;
+F : '(' E ')'
+  | id
+  ;
@@ -9,6 +9,37 @@
 #include <sstream>
 #include <algorithm>
 #include <functional>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <bit>
+#include <climits>
+#include <tuple>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <span>
+#include <charconv>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <random>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <array>
+#include <bitset>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -148,34 +179,10 @@ struct Tree {
         }
     };
 
-	bool rightmost_add(string& lhs, string& rhs) {
-		bool added = false;
-		_rightmost_add(root, lhs, rhs, added);
-		return added;
-	}
-
-	void _rightmost_add(TreeNode& n, string& lhs, string& rhs, bool& added) {
-		if (added) return;
-
-		if (n.children.size() == 0) {
-			if (n.data == lhs) {
-				if (rhs != "id") {
-					for (char c : rhs) n.children.emplace_back(string(1, c));
-				} else {
-					n.children.emplace_back("id");
-				}
-				added = true;
-			}
-		}
-
-		for (auto i = n.children.rbegin(); i < n.children.rend(); i++) {
-			_rightmost_add(*i, lhs, rhs, added);
-		}
-	}
-
     TreeNode root;
 
     Tree(string _root) : root(_root) {}
+    Tree(TreeNode _root) : root(move(_root)) {}
     
     friend ostream& operator<< (ostream& os, Tree& tree) {
         TextBox tb = create_tree_textbox(tree.root);
@@ -191,12 +198,12 @@ private:
             return tb;
 
         vector<TextBox> child_tbs;
-        for (auto child : node.children)
+        for (const auto& child : node.children)
             child_tbs.push_back(create_tree_textbox(child));
         
         tb.vline(0, 1, 1);
         int i = 0;
-        for (auto child : child_tbs) {
+        for (const auto& child : child_tbs) {
             tb.vline(i, 2, 2);
             tb(i, 4) << child;
             i += child.width() + padding;
@@ -210,13 +217,18 @@ private:
 // TREE DRAWING END
 
 
-#define TOKEN_CASE(chr, tkn) \
-	case chr: \
-		cur = lookahead + 1; \
-		return tkn;
-
-template <class T, class Container = deque<T>>
+template <class T, class Container = vector<T>>
 class printable_stack : public stack<T, Container> {
+public:
+	// Empties the stack, keeping its storage.
+	void clear() {
+		this->c.clear();
+	}
+
+	void reserve(size_t n) {
+		this->c.reserve(n);
+	}
+
 	friend ostream& operator<<(ostream& os, const printable_stack<T, Container>& stk) {
 		stringstream ss;
 		ss << "[";
@@ -228,449 +240,2726 @@ class printable_stack : public stack<T, Container> {
 	}
 };
 
-enum class Token {
-	ID, PLUS, MULT, BRACKET_OPEN, BRACKET_CLOSE, EOI, ERR
+// The blanks between tokens. The next_token() written by emit_cpp skips the
+// same set.
+inline bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+size_t skip_blanks_scalar(const char* p, size_t n) {
+	size_t i = 0;
+	while (i < n && is_blank(p[i])) i++;
+	return i;
+}
+
+// Byte sets as runs of consecutive values [first, second], so that a run
+// is one range compare per vector.
+typedef vector<pair<uint8_t, uint8_t>> ByteRuns;
+
+// Movemasks of the blanks and of the bytes in runs among 32 (AVX2) or 16
+// (SSE2) bytes. A byte is in [lo, hi] if min(b - lo, hi - lo) == b - lo,
+// unsigned.
+#if defined(__AVX2__)
+inline uint32_t blank_mask(__m256i v) {
+	__m256i blank = _mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+		_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+	return _mm256_movemask_epi8(blank);
+}
+
+inline uint32_t runs_mask(__m256i v, const ByteRuns& runs) {
+	__m256i in = _mm256_setzero_si256();
+	for (auto [lo, hi] : runs) {
+		__m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(static_cast<char>(lo)));
+		in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(static_cast<char>(hi - lo))), d));
+	}
+	return _mm256_movemask_epi8(in);
+}
+#endif
+
+#if defined(__SSE2__)
+inline uint32_t blank_mask(__m128i v) {
+	__m128i blank = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+		_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+	return _mm_movemask_epi8(blank);
+}
+
+inline uint32_t runs_mask(__m128i v, const ByteRuns& runs) {
+	__m128i in = _mm_setzero_si128();
+	for (auto [lo, hi] : runs) {
+		__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>(lo)));
+		in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(static_cast<char>(hi - lo))), d));
+	}
+	return _mm_movemask_epi8(in);
+}
+#endif
+
+// Length of the run of blanks at p, at most n. Compares 32 (AVX2) or 16
+// (SSE2) bytes at a time against the four blanks and finds the first
+// other byte in the movemask; the tail and other targets go byte by byte.
+size_t skip_blank_run(const char* p, size_t n) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 32 <= n; i += 32) {
+		uint32_t other = ~blank_mask(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+		if (other) return i + countr_zero(other);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		uint32_t other = ~blank_mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))) & 0xffff;
+		if (other) return i + countr_zero(other);
+	}
+#endif
+	return i + skip_blanks_scalar(p + i, n - i);
+}
+
+inline size_t skip_blanks(const char* p, size_t n) {
+	// no blank or a single one between tokens is the common case
+	if (n == 0 || !is_blank(p[0])) return 0;
+	if (n == 1 || !is_blank(p[1])) return 1;
+	return 2 + skip_blank_run(p + 2, n - 2);
+}
+
+const char* skip_blanks_path() {
+#if defined(__AVX2__)
+	return "AVX2";
+#elif defined(__SSE2__)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+// Classes of up to 64 input bytes as bitmaps: bit i is set in blank if
+// byte i is a blank, in single if it is a token on its own (an operator)
+// and in start if a longer token can begin with it (a name or a number).
+// Lexer::next() keeps to skip_blanks() and the single byte lookup in
+// match(): taking its tokens from the bitmap measured slower.
+struct TokenBitmap {
+	uint64_t blank = 0;
+	uint64_t single = 0;
+	uint64_t start = 0;
 };
 
-string token_to_str(const Token& token) {
-	switch(token) {
-		case Token::ID:
-			return "<ID>";
-		case Token::PLUS:
-			return "<PLUS>";
-		case Token::MULT:
-			return "<MULT>";
-		case Token::BRACKET_OPEN:
-			return "<BRACKET_OPEN>";
-		case Token::BRACKET_CLOSE:
-			return "<BRACKET_CLOSE>";
-		case Token::EOI:
-			return "<$>";
-		case Token::ERR:
-			return "<ERROR>";
+// A DFA recognizing the terminals of a parse table. A terminal with a
+// pattern matches that regex, any other its name literally, and the last
+// terminal (the end of input marker) matches nothing. Bytes no pattern tells
+// apart share a class, so a row of the transition table has one entry per
+// class. The DFA is minimized; state 0 is the dead state.
+//
+// Patterns have literal bytes, escapes (\n \t \r, the classes \d \w \s and
+// their negations \D \W \S, any other escaped byte stands for itself), . for
+// anything but a newline, [...] sets with ranges and ^, grouping with ( ),
+// alternation with | and the * + ? operators. The longest match wins, and
+// on equal length a literal beats a pattern, then the lower terminal.
+class TokenDfa {
+public:
+	array<uint8_t, 256> byte_class {};
+	int num_classes = 0;
+	int start = 0;
+	vector<int32_t> next;    // num_states x num_classes
+	vector<int32_t> accept;  // terminal of every state, -1 if none
+	array<int16_t, 256> single_byte;  // terminal of a byte that is always a token on its own, -1 otherwise
+	array<uint8_t, 256> byte_kind;    // 1 blank, 2 single byte token, 4 starts a longer token
+	ByteRuns single_runs, start_runs;
+
+	TokenDfa() = default;
+
+	TokenDfa(const vector<string>& terminals, const vector<string>& patterns) {
+		// one NFA for all terminals, starting at state 0
+		nfa.push_back({});
+		int eoi = terminals.size() - 1;
+		for (int t = 0; t < eoi; t++) {
+			bool is_pattern = t < patterns.size() && !patterns[t].empty();
+			Fragment f = is_pattern ? compile(terminals[t], patterns[t]) : literal(terminals[t]);
+			nfa[0].eps.push_back(f.in);
+			nfa[f.out].accept = t;
+			nfa[f.out].rank = is_pattern ? eoi + t : t;
+		}
+		build();
+		if (accept[start] != -1)
+			throw runtime_error("pattern for " + terminals[accept[start]] + " matches the empty string");
+	}
+
+	int num_states() const {
+		return accept.size();
+	}
+
+	// The TokenBitmap of the min(n, 64) bytes at p. A whole block is
+	// classified 32 (AVX2) or 16 (SSE2) bytes at a time unless the byte sets
+	// take more runs than are worth comparing, as patterns like [^"] or .
+	// can make them.
+	TokenBitmap classify(const char* p, size_t n) const {
+		if (n < 64 || single_runs.size() + start_runs.size() > 16) return classify_scalar(p, min<size_t>(n, 64));
+		TokenBitmap m;
+#if defined(__AVX2__)
+		for (int i = 0; i < 64; i += 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			m.blank |= uint64_t(blank_mask(v)) << i;
+			m.single |= uint64_t(runs_mask(v, single_runs)) << i;
+			m.start |= uint64_t(runs_mask(v, start_runs)) << i;
+		}
+#elif defined(__SSE2__)
+		for (int i = 0; i < 64; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			m.blank |= uint64_t(blank_mask(v)) << i;
+			m.single |= uint64_t(runs_mask(v, single_runs)) << i;
+			m.start |= uint64_t(runs_mask(v, start_runs)) << i;
+		}
+#else
+		m = classify_scalar(p, 64);
+#endif
+		return m;
+	}
+
+	TokenBitmap classify_scalar(const char* p, size_t n) const {
+		TokenBitmap m;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t k = byte_kind[static_cast<unsigned char>(p[i])];
+			m.blank |= (k & 1) << i;
+			m.single |= (k >> 1 & 1) << i;
+			m.start |= (k >> 2 & 1) << i;
+		}
+		return m;
+	}
+
+	// Longest match at p: sets token (-1 if nothing matches) and returns its
+	// length. live is set if the DFA was still running at p + n, so more
+	// input could give a longer match.
+	size_t match(const char* p, size_t n, int& token, bool& live) const {
+		live = false;
+		if (n > 0 && single_byte[static_cast<unsigned char>(p[0])] != -1) {
+			token = single_byte[static_cast<unsigned char>(p[0])];
+			return 1;
+		}
+		token = -1;
+		size_t len = 0;
+		int s = start;
+		size_t i = 0;
+		for (; i < n; i++) {
+			s = next[s * num_classes + byte_class[static_cast<unsigned char>(p[i])]];
+			if (s == 0) break;
+			if (accept[s] != -1) {
+				token = accept[s];
+				len = i + 1;
+			}
+		}
+		live = i == n && s != 0;
+		return len;
+	}
+
+private:
+	struct NfaState {
+		bitset<256> chars;  // bytes leading to next
+		int next = -1;
+		vector<int> eps;
+		int accept = -1;
+		int rank = 0;       // lower wins between accepting states
+	};
+
+	struct Fragment {
+		int in;
+		int out;
+	};
+
+	int add_state() {
+		nfa.push_back({});
+		return nfa.size() - 1;
+	}
+
+	Fragment chars(const bitset<256>& set) {
+		int in = add_state(), out = add_state();
+		nfa[in].chars = set;
+		nfa[in].next = out;
+		return {in, out};
+	}
+
+	Fragment concat(Fragment a, Fragment b) {
+		nfa[a.out].eps.push_back(b.in);
+		return {a.in, b.out};
+	}
+
+	Fragment literal(const string& text) {
+		int s = add_state();
+		Fragment f {s, s};
+		for (char c : text) {
+			bitset<256> set;
+			set.set(static_cast<unsigned char>(c));
+			f = concat(f, chars(set));
+		}
+		return f;
+	}
+
+	Fragment compile(const string& name, const string& pattern) {
+		re_name = name;
+		re = pattern;
+		pos = 0;
+		Fragment f = alternation();
+		if (pos < re.size())
+			fail("unbalanced )");
+		return f;
+	}
+
+	Fragment alternation() {
+		Fragment f = sequence();
+		while (pos < re.size() && re[pos] == '|') {
+			pos++;
+			Fragment g = sequence();
+			int in = add_state(), out = add_state();
+			nfa[in].eps = {f.in, g.in};
+			nfa[f.out].eps.push_back(out);
+			nfa[g.out].eps.push_back(out);
+			f = {in, out};
+		}
+		return f;
+	}
+
+	Fragment sequence() {
+		int s = add_state();
+		Fragment f {s, s};
+		while (pos < re.size() && re[pos] != '|' && re[pos] != ')')
+			f = concat(f, repetition());
+		return f;
+	}
+
+	Fragment repetition() {
+		Fragment f = atom();
+		while (pos < re.size() && (re[pos] == '*' || re[pos] == '+' || re[pos] == '?')) {
+			char op = re[pos++];
+			int in = add_state(), out = add_state();
+			nfa[in].eps.push_back(f.in);
+			if (op != '+') nfa[in].eps.push_back(out);
+			if (op != '?') nfa[f.out].eps.push_back(f.in);
+			nfa[f.out].eps.push_back(out);
+			f = {in, out};
+		}
+		return f;
+	}
+
+	Fragment atom() {
+		char c = re[pos++];
+		bitset<256> set;
+		switch (c) {
+		case '(': {
+			Fragment f = alternation();
+			if (pos == re.size())
+				fail("missing )");
+			pos++;
+			return f;
+		}
+		case '[':
+			return chars(char_set());
+		case '.':
+			set.set();
+			set.reset('\n');
+			return chars(set);
+		case '\\':
+			return chars(escape());
+		case '*':
+		case '+':
+		case '?':
+			fail(string("nothing to repeat before ") + c);
 		default:
-			return "unrecogonized token";
+			set.set(static_cast<unsigned char>(c));
+			return chars(set);
+		}
 	}
-}
 
+	// The bytes of the escape after a backslash.
+	bitset<256> escape() {
+		if (pos == re.size())
+			fail("trailing backslash");
+		char c = re[pos++];
+		bitset<256> set;
+		switch (tolower(c)) {
+		case 'd':
+			for (int b = '0'; b <= '9'; b++) set.set(b);
+			break;
+		case 'w':
+			for (int b = 0; b < 256; b++)
+				if (isalnum(b) || b == '_') set.set(b);
+			break;
+		case 's':
+			for (char b : string(" \t\n\r\f\v")) set.set(b);
+			break;
+		default:
+			set.set(escaped_byte(c));
+			return set;
+		}
+		return isupper(c) ? ~set : set;
+	}
+
+	static unsigned char escaped_byte(char c) {
+		return c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+	}
+
+	// A [...] set, after the [.
+	bitset<256> char_set() {
+		bool negate = pos < re.size() && re[pos] == '^';
+		if (negate) pos++;
+		bitset<256> set;
+		// a ] right after [ or [^ is a member
+		bool first = true;
+		auto byte = [&]() -> int {
+			if (re[pos] != '\\') return static_cast<unsigned char>(re[pos++]);
+			if (++pos == re.size())
+				fail("missing ]");
+			return escaped_byte(re[pos++]);
+		};
+		while (true) {
+			if (pos == re.size())
+				fail("missing ]");
+			if (re[pos] == ']' && !first) break;
+			first = false;
+			if (re[pos] == '\\' && pos + 1 < re.size() && string("dDwWsS").find(re[pos + 1]) != string::npos) {
+				pos++;
+				set |= escape();
+				continue;
+			}
+			int lo = byte(), hi = lo;
+			if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']') {
+				pos++;
+				hi = byte();
+				if (hi < lo)
+					fail("bad range in []");
+			}
+			for (int b = lo; b <= hi; b++) set.set(b);
+		}
+		pos++;
+		return negate ? ~set : set;
+	}
+
+	[[noreturn]] void fail(const string& msg) const {
+		throw runtime_error("pattern for " + re_name + ": " + msg);
+	}
+
+	// Byte classes, subset construction and Moore's partition refinement.
+	void build() {
+		vector<bitset<256>> sets;
+		for (auto& s : nfa)
+			if (s.next != -1 && find(sets.begin(), sets.end(), s.chars) == sets.end()) sets.push_back(s.chars);
+		map<vector<bool>, int> classes;
+		vector<int> representative;
+		for (int b = 0; b < 256; b++) {
+			vector<bool> member;
+			for (auto& s : sets) member.push_back(s[b]);
+			auto it = classes.find(member);
+			if (it == classes.end()) {
+				it = classes.insert({member, representative.size()}).first;
+				representative.push_back(b);
+			}
+			byte_class[b] = it->second;
+		}
+		num_classes = representative.size();
+
+		// DFA states are sets of NFA states, the empty set (dead) first
+		map<vector<int>, int> ids;
+		vector<vector<int>> subsets;
+		auto add = [&](vector<int> s) {
+			for (size_t i = 0; i < s.size(); i++)
+				for (int e : nfa[s[i]].eps)
+					if (find(s.begin(), s.end(), e) == s.end()) s.push_back(e);
+			sort(s.begin(), s.end());
+			auto it = ids.find(s);
+			if (it != ids.end()) return it->second;
+			ids[s] = subsets.size();
+			subsets.push_back(s);
+			return static_cast<int>(subsets.size() - 1);
+		};
+		add({});
+		add({0});
+		vector<int32_t> dnext;
+		vector<int32_t> daccept;
+		for (size_t d = 0; d < subsets.size(); d++) {
+			vector<int> subset = subsets[d];
+			for (int c = 0; c < num_classes; c++) {
+				vector<int> moved;
+				for (int n : subset)
+					if (nfa[n].next != -1 && nfa[n].chars[representative[c]] && find(moved.begin(), moved.end(), nfa[n].next) == moved.end())
+						moved.push_back(nfa[n].next);
+				dnext.push_back(add(moved));
+			}
+			int best = -1;
+			for (int n : subset)
+				if (nfa[n].accept != -1 && (best == -1 || nfa[n].rank < nfa[best].rank)) best = n;
+			daccept.push_back(best == -1 ? -1 : nfa[best].accept);
+		}
+
+		// split blocks of states until all states in a block agree on the
+		// blocks they move to
+		int n = subsets.size();
+		vector<int> block(n);
+		for (int s = 0; s < n; s++) block[s] = daccept[s] + 1;
+		for (int count = 0;;) {
+			map<vector<int>, int> signatures;
+			vector<int> refined(n);
+			for (int s = 0; s < n; s++) {
+				vector<int> sig {block[s]};
+				for (int c = 0; c < num_classes; c++) sig.push_back(block[dnext[s * num_classes + c]]);
+				refined[s] = signatures.insert({sig, signatures.size()}).first->second;
+			}
+			block = refined;
+			if (signatures.size() == count) break;
+			count = signatures.size();
+		}
+
+		// renumber with the dead state's block first
+		vector<int> id(n, -1);
+		int blocks = 0;
+		id[block[0]] = blocks++;
+		for (int s = 1; s < n; s++)
+			if (id[block[s]] == -1) id[block[s]] = blocks++;
+		next.assign(blocks * num_classes, 0);
+		accept.assign(blocks, -1);
+		for (int s = 0; s < n; s++) {
+			for (int c = 0; c < num_classes; c++) next[id[block[s]] * num_classes + c] = id[block[dnext[s * num_classes + c]]];
+			accept[id[block[s]]] = daccept[s];
+		}
+		start = id[block[1]];
+		nfa.clear();
+
+		// operators and the like: the byte leads to an accepting state
+		// with no way out
+		for (int b = 0; b < 256; b++) {
+			int s = next[start * num_classes + byte_class[b]];
+			bool last = s != 0 && accept[s] != -1;
+			for (int c = 0; c < num_classes && last; c++) last = next[s * num_classes + c] == 0;
+			single_byte[b] = last ? accept[s] : -1;
+		}
+
+		// the same for the classifier, with the bytes that lead anywhere
+		// else as token starts
+		single_runs.clear();
+		start_runs.clear();
+		auto extend = [](ByteRuns& runs, int b) {
+			if (!runs.empty() && runs.back().second == b - 1) runs.back().second = b;
+			else runs.push_back({b, b});
+		};
+		for (int b = 0; b < 256; b++) {
+			bool single = single_byte[b] != -1;
+			bool starts = !single && next[start * num_classes + byte_class[b]] != 0;
+			byte_kind[b] = is_blank(b) | single << 1 | starts << 2;
+			if (single) extend(single_runs, b);
+			if (starts) extend(start_runs, b);
+		}
+	}
+
+	vector<NfaState> nfa;
+	string re_name;
+	string re;
+	size_t pos = 0;
+};
+
+// Splits the input into the terminals of a parse table, named as in the
+// grammar. Whitespace is skipped and the token at the cursor is the longest
+// match of the table's TokenDfa; the last terminal is the end of input
+// marker. Errors are returned as ERR and left to the caller to report.
 class Lexer {
 public:
-	Lexer(const string input) {
-		input_buffer = input;
+	static const int ERR = -1;
+
+	// input has to outlive the lexer.
+	Lexer(string_view input, const vector<string>& terminals, const TokenDfa& tokenDfa)
+		:input_buffer(input), terminals(terminals), dfa(tokenDfa), eoi(terminals.size() - 1) {
 	}
-	
-	Token next() {
+
+	int next() {
+		// Ignore whitespace
+		cur += skip_blanks(input_buffer.data() + cur, input_buffer.size() - cur);
+		start = cur;
+
 		if (cur >= input_buffer.size()) {
 			// No more input to read, return end of input token
-			return Token::EOI;
-		}
-		
-		// Ignore whitespace
-		while (input_buffer[cur] == ' ' || input_buffer[cur] == '\t') cur++;
-
-		int lookahead = cur;
-		switch(input_buffer[lookahead]) {
-			TOKEN_CASE('+', Token::PLUS)
-			TOKEN_CASE('*', Token::MULT)
-			TOKEN_CASE('(', Token::BRACKET_OPEN)
-			TOKEN_CASE(')', Token::BRACKET_CLOSE)
-			TOKEN_CASE('\0', Token::EOI)
-			case 'i':
-				if (input_buffer[++lookahead] == 'd') {
-					cur = lookahead + 1;
-					return Token::ID;
-				}
-				error();
-				return Token::ERR;
-			default:
-				error();
-				return Token::ERR;
+			return eoi;
 		}
+
+		int token;
+		bool live;
+		size_t len = dfa.match(input_buffer.data() + cur, input_buffer.size() - cur, token, live);
+		if (token == ERR) return ERR;
+		cur += len;
+		return token;
+	}
+
+	string token_str(int token) const {
+		return token == ERR ? "<ERROR>" : "<" + terminals[token] + ">";
+	}
+
+	// Bytes consumed so far.
+	uint64_t offset() const {
+		return cur;
+	}
+
+	// Where the token last returned by next() starts.
+	uint64_t token_begin() const {
+		return start;
 	}
 
 	friend ostream& operator<<(ostream& os, const Lexer& lex) {
 		stringstream ss;
-		for (int i = (lex.input_buffer[lex.cur] == ' ')? lex.cur + 1 : lex.cur; i < lex.input_buffer.size(); i++) ss << lex.input_buffer[i];
+		for (int i = (lex.cur < lex.input_buffer.size() && lex.input_buffer[lex.cur] == ' ')? lex.cur + 1 : lex.cur; i < lex.input_buffer.size(); i++) ss << lex.input_buffer[i];
 		ss << " $";
 		os << ss.str();
 		return os;
 	}
 	
-	void display_current_state(const string& msg) {
+	void display_current_state(const string& msg) const {
 		cout << input_buffer << endl;
 		for(int i = 0; i < cur; i++) cout << ' ';
 		cout << "^ " << msg << endl;
 	}
 
 private:
-	void error() {
-		cout << "Lex error: " << endl << input_buffer << endl;
-		for(int i = 0; i < cur; i++) cout << ' ';
-		cout << "^ error occured while trying to lex." << endl;
-	}
-
 	int cur = 0;
-	string input_buffer;
+	int start = 0;
+	string_view input_buffer;
+	const vector<string>& terminals;
+	const TokenDfa& dfa;
+	int eoi;
 };
 
+// A parse table cell packed into one word: the action kind sits in the top
+// two bits and the shift state or production id in the low 30 bits. A zeroed
+// cell is an error.
 class Action {
 public:
-	enum ActionType {
+	enum ActionType : uint32_t {
+		Error,
 		Shift,
 		Reduce,
-		Accept,
-		Error
+		Accept
 	};
 
-	ActionType type;
+	static constexpr uint32_t VALUE_MASK = (1u << 30) - 1;
+
+	constexpr Action() : word(0) {}
+	constexpr Action(ActionType type, int value = 0) : word((static_cast<uint32_t>(type) << 30) | (static_cast<uint32_t>(value) & VALUE_MASK)) {}
+
+	ActionType type() const { return static_cast<ActionType>(word >> 30); }
+	int value() const { return static_cast<int>(word & VALUE_MASK); }
+
+	bool operator==(const Action& other) const { return word == other.word; }
+	bool operator!=(const Action& other) const { return word != other.word; }
+
+	uint32_t word;
 };
 
-class ShiftAction : public Action {
-public:
-	ShiftAction(int shiftState)
-		:shift_state(shiftState)  {
-		type = Action::Shift;
+#define ERR_ACTN Action(Action::Error)
+#define ACC_ACTN Action(Action::Accept)
+#define SHFT_ACTN(i) Action(Action::Shift, i)
+#define REDC_ACTN(i) Action(Action::Reduce, i)
+
+// What a reduce needs to know about its production once the table is built.
+struct ProductionInfo {
+	int lhs;
+	int pop_amt;
+};
+
+typedef int SymbolId;
+
+// Interns every grammar symbol once. Terminals are numbered before
+// nonterminals, so a terminal's id is its ACTION column and a nonterminal's
+// id minus num_terminals is its GOTO column.
+struct SymbolTable {
+	SymbolId intern(const string& name) {
+		auto it = ids.find(name);
+		if (it != ids.end()) return it->second;
+		ids[name] = names.size();
+		names.push_back(name);
+		return names.size() - 1;
+	}
+
+	SymbolId find(const string& name) const {
+		auto it = ids.find(name);
+		return it == ids.end() ? -1 : it->second;
 	}
-	int shift_state;
+
+	const string& name(SymbolId id) const { return names[id]; }
+	bool is_terminal(SymbolId id) const { return id < num_terminals; }
+	int size() const { return names.size(); }
+	int num_non_terminals() const { return size() - num_terminals; }
+
+	vector<string> names;
+	unordered_map<string, SymbolId> ids;
+	int num_terminals = 0;
 };
 
-class ReduceAction : public Action {
-public:
-	ReduceAction(const string& productionLhs, const string& productionRhs, int i)
-		:production_lhs(productionLhs), production_rhs(productionRhs), pop_amt(productionRhs == "id" ? 1 : productionRhs.size()), production_id(i)  {
-		type = Action::Reduce;
+// Bitset over terminal ids. It is sized once per grammar, so unions and
+// membership tests never allocate.
+struct TerminalSet {
+	TerminalSet(int num_terminals = 0) : words((num_terminals + 63) / 64, 0) {}
+
+	void insert(SymbolId t) { words[t >> 6] |= 1ull << (t & 63); }
+	bool contains(SymbolId t) const { return (words[t >> 6] >> (t & 63)) & 1; }
+
+	// Returns whether any bit was added.
+	bool or_with(const TerminalSet& other) {
+		uint64_t added = 0;
+		for (size_t i = 0; i < words.size(); i++) {
+			added |= other.words[i] & ~words[i];
+			words[i] |= other.words[i];
+		}
+		return added != 0;
 	}
-	int production_id;
-	int pop_amt;
-	string production_lhs;
-	string production_rhs;
+
+	template <class F>
+	void for_each(F f) const {
+		for (size_t i = 0; i < words.size(); i++)
+			for (uint64_t w = words[i]; w; w &= w - 1)
+				f(static_cast<SymbolId>(i * 64 + countr_zero(w)));
+	}
+
+	vector<uint64_t> words;
 };
 
-class Parser {
-public:
-	Parser(map<pair<int, Token>, Action*> actionMap, map<pair<int, string>, int> gotoMap)
-		:action_map(actionMap), goto_map(gotoMap) {
-		parse_stack.push(0);
+// A right hand side as text: single character symbols run together as in
+// E+T, names of several characters are separated by spaces. The item dot
+// goes in front of symbol dot_idx.
+string rhs_str(const vector<string>& names, int dot_idx = -1) {
+	bool spaced = false;
+	if (names.size() > 1)
+		for (auto& n : names) spaced |= n.size() > 1;
+	string s;
+	for (int i = 0; i <= names.size(); i++) {
+		if (i == dot_idx) s += ".";
+		if (i < names.size()) s += names[i] + (spaced && i + 1 < names.size() ? " " : "");
 	}
+	return s;
+}
 
-	bool parse(const string& input) {
-		Lexer lex(input);
-		cout << left << setw(25) << "Stack"     << setw(25) << "Current Token" << setw(25) << "Input" << setw(25) << "Action" << endl;
-		cout << left << setw(25) << parse_stack << setw(25) << "- "            << setw(25) << lex     << setw(25) << "-"<< endl;
-		Token a = lex.next();
-		while (true) {
-			if (a == Token::ERR) return false;
-			int s = parse_stack.top();
-			if (action_map[{s, a}]->type == Action::Shift) {
-				ShiftAction* sa = reinterpret_cast<ShiftAction*>(action_map[{s, a}]);
-				parse_stack.push(sa->shift_state);
-				cout << left << setw(25) << parse_stack << setw(25) << token_to_str(a) << setw(25) << lex << setw(25) << "Shift to " + to_string(sa->shift_state) << endl;
-				a = lex.next();
-			} else if (action_map[{s, a}]->type  == Action::Reduce) {
-				ReduceAction* ra = reinterpret_cast<ReduceAction*>(action_map[{s, a}]);
-				for (int i = 0; i < ra->pop_amt; i++) parse_stack.pop();
-				int t = parse_stack.top();
-				if (goto_map[{t, ra->production_lhs}] == -1) {
-					error(a, lex);
-					return false;
+// ACTION and GOTO packed the way yacc packs them. Every state has a
+// default action, the reduction filling most of its row (error if it has
+// none), and its other cells go into a comb vector: the cell for (state,
+// terminal) is action_table[action_base[state] + terminal] if action_check
+// there holds the terminal, the default otherwise. Rows with the same cells
+// share a base. GOTO is packed the same way by nonterminal column, each
+// column defaulting to its most common target.
+//
+// Default reductions turn error cells into reductions, so an error is found
+// a few reductions later, but never after shifting a wrong token.
+struct CompressedTable {
+	vector<Action> default_action;
+	vector<int32_t> action_base;
+	vector<Action> action_table;
+	vector<int32_t> action_check;
+	vector<int32_t> default_goto;
+	vector<int32_t> goto_base;
+	vector<int32_t> goto_table;
+	vector<int32_t> goto_check;
+
+	CompressedTable(int num_states, int num_terminals, int num_non_terminals, const vector<Action>& action, const vector<int32_t>& goto_dense) {
+		vector<vector<pair<int, uint32_t>>> rows(num_states);
+		for (int s = 0; s < num_states; s++) {
+			map<uint32_t, int> reductions;
+			for (int t = 0; t < num_terminals; t++) {
+				Action a = action[s * num_terminals + t];
+				if (a.type() == Action::Reduce) reductions[a.word]++;
+			}
+			Action def = ERR_ACTN;
+			int most = 0;
+			for (auto& r : reductions) {
+				if (r.second > most) {
+					def.word = r.first;
+					most = r.second;
 				}
-				parse_stack.push(goto_map[{t, ra->production_lhs}]);
-				cout << left << setw(25) << parse_stack << setw(25) << token_to_str(a) << setw(25) << lex << setw(25) << "Reduce by " + ra->production_lhs + " -> " + ra->production_rhs << endl;
-				//cout << "Using production " << ra->production_lhs << " -> " << ra->production_rhs << endl;
-				production_stack.push({ra->production_lhs, ra->production_rhs});
-			} else if (action_map[{s, a}]->type == Action::Accept) {
-				cout << left << setw(25) << parse_stack << setw(25) << token_to_str(a) << setw(25) << lex << setw(25) << "Accepted" << endl;
-				Tree pt = create_parse_tree();
-				cout << "\nThe parse tree for the string is : \n" << pt << "\n";
-				return true;
-			} else {
-				error(a, lex);
-				return false;
+			}
+			default_action.push_back(def);
+			// error cells are left to the default as well
+			for (int t = 0; t < num_terminals; t++) {
+				Action a = action[s * num_terminals + t];
+				if (a != def && a.type() != Action::Error) rows[s].push_back({t, a.word});
+			}
+		}
+		vector<uint32_t> words;
+		pack(rows, num_terminals, action_base, words, action_check);
+		for (uint32_t w : words) {
+			Action a;
+			a.word = w;
+			action_table.push_back(a);
+		}
+
+		vector<vector<pair<int, uint32_t>>> columns(num_non_terminals);
+		for (int n = 0; n < num_non_terminals; n++) {
+			map<int32_t, int> targets;
+			for (int s = 0; s < num_states; s++)
+				if (goto_dense[s * num_non_terminals + n] != -1) targets[goto_dense[s * num_non_terminals + n]]++;
+			int32_t def = -1;
+			int most = 0;
+			for (auto& t : targets) {
+				if (t.second > most) {
+					def = t.first;
+					most = t.second;
+				}
+			}
+			default_goto.push_back(def);
+			for (int s = 0; s < num_states; s++) {
+				int32_t g = goto_dense[s * num_non_terminals + n];
+				if (g != -1 && g != def) columns[n].push_back({s, static_cast<uint32_t>(g)});
 			}
 		}
+		words.clear();
+		pack(columns, num_states, goto_base, words, goto_check);
+		goto_table.assign(words.begin(), words.end());
 	}
-private:
-	printable_stack<int> parse_stack;
-	map<pair<int, Token>, Action*> action_map;
-	map<pair<int, string>, int> goto_map;
-	stack<pair<string, string>> production_stack;
 
-	void error(Token cur_token, Lexer& lex) {
-		cout << "Encountered error while parsing : Unexpected token " << token_to_str(cur_token) << endl;
-		lex.display_current_state("Parse error");
+	Action action_at(int state, int terminal) const {
+		int i = action_base[state] + terminal;
+		return action_check[i] == terminal ? action_table[i] : default_action[state];
+	}
+
+	int32_t goto_at(int state, int non_terminal) const {
+		int i = goto_base[non_terminal] + state;
+		return goto_check[i] == state ? goto_table[i] : default_goto[non_terminal];
 	}
 
-	void print_state() {
-		cout << "This is test string lol this string is supposed to be very big lol lets see";
-		cout << "lol " << endl;
+	size_t bytes() const {
+		return (default_action.size() + action_base.size() + action_table.size() + action_check.size() + default_goto.size() + goto_base.size() + goto_table.size() + goto_check.size()) * 4;
 	}
 
-	Tree create_parse_tree() {
-		Tree parse_tree("E");
-		while (!production_stack.empty()) {
-			auto prod = production_stack.top(); production_stack.pop();
-			parse_tree.rightmost_add(prod.first, prod.second);
+	// First fit packing of sparse rows of (column, value) cells, most filled
+	// rows first. Rows with the same cells get the same base, other rows get
+	// distinct ones, so a check entry equal to the column identifies the row.
+	// Empty rows point past the packed cells, into width slots of padding that
+	// also keep every base + column in range.
+	static void pack(const vector<vector<pair<int, uint32_t>>>& rows, int width, vector<int32_t>& base, vector<uint32_t>& table, vector<int32_t>& check) {
+		vector<int> order(rows.size());
+		for (int i = 0; i < rows.size(); i++) order[i] = i;
+		stable_sort(order.begin(), order.end(), [&](int a, int b) { return rows[a].size() > rows[b].size(); });
+
+		base.assign(rows.size(), -1);
+		table.clear();
+		check.clear();
+		map<vector<pair<int, uint32_t>>, int> placed;
+		set<int> used;
+		for (int r : order) {
+			if (rows[r].empty()) continue;
+			auto it = placed.find(rows[r]);
+			if (it != placed.end()) {
+				base[r] = it->second;
+				continue;
+			}
+			int b = 0;
+			while (true) {
+				bool fits = used.find(b) == used.end();
+				for (auto& c : rows[r])
+					if (fits && b + c.first < check.size() && check[b + c.first] != -1) fits = false;
+				if (fits) break;
+				b++;
+			}
+			for (auto& c : rows[r]) {
+				if (b + c.first >= check.size()) {
+					check.resize(b + c.first + 1, -1);
+					table.resize(b + c.first + 1, 0);
+				}
+				check[b + c.first] = c.first;
+				table[b + c.first] = c.second;
+			}
+			base[r] = b;
+			used.insert(b);
+			placed[rows[r]] = b;
 		}
-		return parse_tree;
+		int padding = check.size();
+		check.resize(padding + width, -1);
+		table.resize(padding + width, 0);
+		for (auto& b : base)
+			if (b == -1) b = padding;
 	}
 };
 
-#define ERR_ACTN new Action {.type = Action::Error}
-#define ACC_ACTN new Action {.type = Action::Accept}
-#define SHFT_ACTN(i) new ShiftAction(i)
-#define REDC_ACTN(i) new ReduceAction(str_productions[i][0], str_productions[i][1], i)
+// Header of the binary table format. The file is a sequence of 4 byte
+// words in host byte order: the header, then the CompressedTable arrays
+// (default actions, action bases, action table and check, default gotos,
+// goto bases, goto table and check), productions as (lhs, pop_amt) pairs,
+// rhs offsets[productions + 1], the rhs symbol ids, name offsets[symbols +
+// terminals + 1] and finally the NUL terminated symbol names followed by the
+// token patterns of the terminals, padded to a whole word.
+struct TableHeader {
+	static const uint32_t MAGIC = 0x4254524c;  // "LRTB"
+	static const uint32_t VERSION = 3;
 
-typedef pair<string, string> production;
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_states;
+	uint32_t num_terminals;
+	uint32_t num_non_terminals;
+	uint32_t num_productions;
+	uint32_t num_rhs;
+	uint32_t names_bytes;
+	uint32_t action_size;
+	uint32_t goto_size;
+};
 
-struct Item {
-	Item(string l, string r, string la = "$") : lhs(l), rhs(r), dot_idx(0), lookahead(la) {}
-	Item(string l, string r, int di, string la = "$") : lhs(l), rhs(r), dot_idx(di), lookahead(la) {}
-    Item(production p, string la = "$") : lhs(p.first), rhs(p.second), dot_idx(0), lookahead(la) {}
-    Item(production p, int di, string la = "$") : lhs(p.first), rhs(p.second), dot_idx(di), lookahead(la) {}
+// Dense row-major form of an ACTION/GOTO table pair. A goto cell is the
+// target state or -1.
+struct ParseTable {
+	int num_states = 0;
+	int num_terminals = 0;
+	int num_non_terminals = 0;
+	vector<Action> action;
+	vector<int32_t> goto_table;
+	vector<ProductionInfo> productions;
+	vector<vector<SymbolId>> production_rhs;
+	vector<string> symbol_names;
+	vector<string> token_patterns;  // regex of a terminal, empty (or missing) to match its name
 
-    bool operator==(const Item& other) const {
-        return (lhs == other.lhs) && (rhs == other.rhs) && (dot_idx == other.dot_idx) && (lookahead == other.lookahead);
-    }
+	Action action_at(int state, int terminal) const {
+		return action[state * num_terminals + terminal];
+	}
 
-    bool operator<(const Item& other) const {
-        return (lhs < other.lhs) && (rhs < other.rhs) && (dot_idx < other.dot_idx) && (lookahead < other.lookahead);
-    }
+	int32_t goto_at(int state, int non_terminal) const {
+		return goto_table[state * num_non_terminals + non_terminal];
+	}
 
-    friend ostream& operator<<(ostream& os, const Item& i) {
-        int idx = i.dot_idx;
-        os << "[" << i.lhs << " -> " << i.rhs.substr(0, idx) << "." << i.rhs.substr(idx) << " , " << i.lookahead << "]";
-        return os; 
-    }
+	size_t bytes() const {
+		return action.size() * sizeof(Action) + goto_table.size() * sizeof(int32_t) + productions.size() * sizeof(ProductionInfo);
+	}
 
-	string lhs;
-	string rhs;
-    string lookahead = "$";
-	int dot_idx;
+	CompressedTable compress() const {
+		return CompressedTable(num_states, num_terminals, num_non_terminals, action, goto_table);
+	}
+
+	const string& lhs_name(int production) const {
+		return symbol_names[num_terminals + productions[production].lhs];
+	}
+
+	TokenDfa token_dfa() const {
+		return TokenDfa(vector<string>(symbol_names.begin(), symbol_names.begin() + num_terminals), token_patterns);
+	}
+
+	string production_str(int production) const {
+		vector<string> rhs;
+		for (SymbolId x : production_rhs[production]) rhs.push_back(symbol_names[x]);
+		return lhs_name(production) + " -> " + rhs_str(rhs);
+	}
+
+	// The table in the binary format read by TableView.
+	vector<uint32_t> serialize() const {
+		vector<uint32_t> rhs_offsets {0}, rhs;
+		for (auto& r : production_rhs) {
+			rhs.insert(rhs.end(), r.begin(), r.end());
+			rhs_offsets.push_back(rhs.size());
+		}
+		vector<uint32_t> name_offsets {0};
+		string names;
+		for (auto& n : symbol_names) {
+			names += n + '\0';
+			name_offsets.push_back(names.size());
+		}
+		for (int t = 0; t < num_terminals; t++) {
+			names += (t < token_patterns.size() ? token_patterns[t] : "") + '\0';
+			name_offsets.push_back(names.size());
+		}
+		names.resize((names.size() + 3) / 4 * 4, '\0');
+
+		CompressedTable c = compress();
+		TableHeader h {TableHeader::MAGIC, TableHeader::VERSION, static_cast<uint32_t>(num_states), static_cast<uint32_t>(num_terminals), static_cast<uint32_t>(num_non_terminals),
+			static_cast<uint32_t>(productions.size()), static_cast<uint32_t>(rhs.size()), static_cast<uint32_t>(names.size()),
+			static_cast<uint32_t>(c.action_table.size()), static_cast<uint32_t>(c.goto_table.size())};
+		vector<uint32_t> out(sizeof(h) / 4);
+		memcpy(out.data(), &h, sizeof(h));
+		for (Action a : c.default_action) out.push_back(a.word);
+		out.insert(out.end(), c.action_base.begin(), c.action_base.end());
+		for (Action a : c.action_table) out.push_back(a.word);
+		out.insert(out.end(), c.action_check.begin(), c.action_check.end());
+		out.insert(out.end(), c.default_goto.begin(), c.default_goto.end());
+		out.insert(out.end(), c.goto_base.begin(), c.goto_base.end());
+		out.insert(out.end(), c.goto_table.begin(), c.goto_table.end());
+		out.insert(out.end(), c.goto_check.begin(), c.goto_check.end());
+		for (auto& p : productions) {
+			out.push_back(p.lhs);
+			out.push_back(p.pop_amt);
+		}
+		out.insert(out.end(), rhs_offsets.begin(), rhs_offsets.end());
+		out.insert(out.end(), rhs.begin(), rhs.end());
+		out.insert(out.end(), name_offsets.begin(), name_offsets.end());
+		size_t at = out.size();
+		out.resize(at + names.size() / 4);
+		memcpy(out.data() + at, names.data(), names.size());
+		return out;
+	}
 };
 
-string str_productions[7][2] = {
-			{"E'", "E"},
-			{"E" , "E+T"},
-			{"E" , "T"},
-			{"T" , "T*F"},
-			{"T" , "F"},
-			{"F" , "(E)"},
-			{"F" , "id"}
+// A parse table used in place from a buffer in the binary format, such as
+// a mapped table file. Nothing is copied, the buffer has to outlive the view.
+struct TableView {
+	int num_states = 0;
+	int num_terminals = 0;
+	int num_non_terminals = 0;
+	int num_productions = 0;
+	int action_size = 0;
+	const Action* default_action = nullptr;
+	const int32_t* action_base = nullptr;
+	const Action* action_table = nullptr;
+	const int32_t* action_check = nullptr;
+	const int32_t* default_goto = nullptr;
+	const int32_t* goto_base = nullptr;
+	const int32_t* goto_table = nullptr;
+	const int32_t* goto_check = nullptr;
+	const ProductionInfo* productions = nullptr;
+	const uint32_t* rhs_offsets = nullptr;
+	const SymbolId* rhs = nullptr;
+	const uint32_t* name_offsets = nullptr;
+	const char* names = nullptr;
+
+	// Checks the header, that every section fits in size bytes and that every
+	// state, production and symbol id in the file is in range, so a corrupt
+	// file is rejected here instead of being indexed by the parser.
+	TableView(const void* data, size_t size) {
+		static_assert(sizeof(Action) == 4 && sizeof(ProductionInfo) == 8);
+		const TableHeader* h = static_cast<const TableHeader*>(data);
+		if (size < sizeof(TableHeader) || h->magic != TableHeader::MAGIC)
+			throw runtime_error("not a parse table file");
+		if (h->version != TableHeader::VERSION)
+			throw runtime_error("parse table version " + to_string(h->version) + ", expected " + to_string(TableHeader::VERSION));
+		uint64_t words = sizeof(TableHeader) / 4 + 2ull * h->num_states + 2ull * h->action_size + 2ull * h->num_non_terminals + 2ull * h->goto_size
+			+ 3ull * h->num_productions + 1 + h->num_rhs + 2ull * h->num_terminals + h->num_non_terminals + 1 + h->names_bytes / 4;
+		if (h->names_bytes % 4 != 0 || words * 4 > size)
+			throw runtime_error("truncated parse table file");
+
+		num_states = h->num_states;
+		num_terminals = h->num_terminals;
+		num_non_terminals = h->num_non_terminals;
+		num_productions = h->num_productions;
+		action_size = h->action_size;
+		const uint32_t* at = reinterpret_cast<const uint32_t*>(h + 1);
+		default_action = reinterpret_cast<const Action*>(at);
+		at += num_states;
+		action_base = reinterpret_cast<const int32_t*>(at);
+		at += num_states;
+		action_table = reinterpret_cast<const Action*>(at);
+		at += h->action_size;
+		action_check = reinterpret_cast<const int32_t*>(at);
+		at += h->action_size;
+		default_goto = reinterpret_cast<const int32_t*>(at);
+		at += num_non_terminals;
+		goto_base = reinterpret_cast<const int32_t*>(at);
+		at += num_non_terminals;
+		goto_table = reinterpret_cast<const int32_t*>(at);
+		at += h->goto_size;
+		goto_check = reinterpret_cast<const int32_t*>(at);
+		at += h->goto_size;
+		productions = reinterpret_cast<const ProductionInfo*>(at);
+		at += 2 * num_productions;
+		rhs_offsets = at;
+		at += num_productions + 1;
+		rhs = reinterpret_cast<const SymbolId*>(at);
+		at += h->num_rhs;
+		name_offsets = at;
+		at += 2 * num_terminals + num_non_terminals + 1;
+		names = reinterpret_cast<const char*>(at);
+
+		auto check = [](bool ok) {
+			if (!ok) throw runtime_error("corrupt parse table file");
 		};
+		check(num_states > 0 && num_productions > 0);
+		// every base + column has to stay inside the comb vectors
+		for (int i = 0; i < num_states; i++)
+			check(action_base[i] >= 0 && action_base[i] + uint64_t(num_terminals) <= h->action_size);
+		for (int i = 0; i < num_non_terminals; i++)
+			check(goto_base[i] >= 0 && goto_base[i] + uint64_t(num_states) <= h->goto_size);
+		// shifts go to states, reductions name productions
+		auto valid_action = [&](Action a) {
+			return a.type() == Action::Shift ? a.value() < num_states : a.type() != Action::Reduce || a.value() < num_productions;
+		};
+		for (int i = 0; i < num_states; i++) check(valid_action(default_action[i]));
+		for (int i = 0; i < action_size; i++) check(valid_action(action_table[i]));
+		// -1 is a missing goto
+		for (int i = 0; i < num_non_terminals; i++) check(default_goto[i] >= -1 && default_goto[i] < num_states);
+		for (uint32_t i = 0; i < h->goto_size; i++) check(goto_table[i] >= -1 && goto_table[i] < num_states);
+		// each production pops as many states as its right hand side has symbols
+		check(rhs_offsets[0] == 0 && rhs_offsets[num_productions] <= h->num_rhs);
+		for (int p = 0; p < num_productions; p++) {
+			check(rhs_offsets[p] <= rhs_offsets[p + 1]);
+			check(productions[p].lhs >= 0 && productions[p].lhs < num_non_terminals);
+			check(productions[p].pop_amt == int64_t(rhs_offsets[p + 1]) - rhs_offsets[p]);
+		}
+		for (uint32_t i = 0; i < h->num_rhs; i++) check(rhs[i] >= 0 && rhs[i] < num_terminals + num_non_terminals);
+		// names and patterns are NUL terminated and inside the names section
+		int num_names = 2 * num_terminals + num_non_terminals;
+		check(name_offsets[0] == 0 && name_offsets[num_names] <= h->names_bytes);
+		for (int i = 0; i < num_names; i++)
+			check(name_offsets[i] < name_offsets[i + 1] && names[name_offsets[i + 1] - 1] == '\0');
+	}
 
-struct Grammar {
+	// Same lookups as CompressedTable.
+	Action action_at(int state, int terminal) const {
+		int i = action_base[state] + terminal;
+		return action_check[i] == terminal ? action_table[i] : default_action[state];
+	}
 
-    Grammar(vector<production> p) : productions(p) {
-        for (auto& i : p)
-            non_terminals.insert(i.first);
-        generate_lr1_items();
-    }
+	int32_t goto_at(int state, int non_terminal) const {
+		int i = goto_base[non_terminal] + state;
+		return goto_check[i] == state ? goto_table[i] : default_goto[non_terminal];
+	}
 
-    set<string> first(string s) {
-        set<string> first_set;
-        for (char c : s) {
-            if (non_terminals.find(string(1, c)) == non_terminals.end()) {
-                first_set.insert(c != 'i' ? string(1,c) : "id");
-                break;
-            } else {
-                string nt = string(1, c);
-                for (auto p : productions) if (p.first == nt && p.second[0] != nt[0]) {
-                    auto tmp = first(p.second);
-                    first_set.insert(tmp.begin(), tmp.end());
-                }
-            }
-        }
-        return first_set;
-    }
+	// Whether the state's only action is its default reduction, which then
+	// needs no lookahead. Such states have an empty row, and empty rows point
+	// at the padding at the end of the comb vector.
+	bool consistent_reduction(int state) const {
+		return action_base[state] == action_size - num_terminals && default_action[state].type() == Action::Reduce;
+	}
 
-    vector<Item> closure(vector<Item> I) {
-        bool done = false;
-        while (!done) {
-            done = true;
-            for (int i = 0; i < I.size(); i++) {
-                Item item = I[i];
-                if (non_terminals.find(item.rhs.substr(item.dot_idx, 1)) != non_terminals.end()) {
-                    string nt = item.rhs.substr(item.dot_idx, 1);
-                    string remaining = item.rhs.substr(item.dot_idx+1) + item.lookahead;
-                    for (auto p : productions) if (p.first == nt) {
-                        auto s = first(remaining);
-                        for (auto k : s) {
-                            auto u = Item(p, k);
-                            bool exists = false;
-                            for (auto& x : I) {
-                                if (x.dot_idx == u.dot_idx && x.lhs == u.lhs && x.rhs == u.rhs && x.lookahead == u.lookahead) {
-                                    exists = true;
-                                    break;
-                                }
-                            }
-                            if (!exists) {
-                                I.push_back(u);
-                                done = false;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        return I;
-    }
+	// The unit production (A -> B, B a nonterminal) that is the state's only
+	// action, -1 if there is none.
+	int unit_reduction(int state) const {
+		if (!consistent_reduction(state)) return -1;
+		int p = default_action[state].value();
+		return productions[p].pop_amt == 1 && *rhs_begin(p) >= num_terminals ? p : -1;
+	}
 
-    vector<Item> Goto(vector<Item> I, string X) {
-        vector<Item> J;
-        for (auto i : I) {
-            if (i.rhs[i.dot_idx] == X[0]) J.push_back(Item(i.lhs, i.rhs, X == "id" ? i.dot_idx + 2 : i.dot_idx+1, i.lookahead));
-        }
-        return closure(J);
-    }
+	const ProductionInfo& production(int p) const {
+		return productions[p];
+	}
+
+	const SymbolId* rhs_begin(int p) const {
+		return rhs + rhs_offsets[p];
+	}
+
+	const SymbolId* rhs_end(int p) const {
+		return rhs + rhs_offsets[p + 1];
+	}
+
+	string_view symbol_name(int symbol) const {
+		return string_view(names + name_offsets[symbol], name_offsets[symbol + 1] - name_offsets[symbol] - 1);
+	}
+
+	// The regex a terminal is lexed by, empty if it matches its name.
+	string_view token_pattern(int terminal) const {
+		return symbol_name(num_terminals + num_non_terminals + terminal);
+	}
+
+	string lhs_name(int p) const {
+		return string(symbol_name(num_terminals + productions[p].lhs));
+	}
+
+	string production_str(int p) const {
+		vector<string> names;
+		for (const SymbolId* x = rhs_begin(p); x != rhs_end(p); x++) names.push_back(string(symbol_name(*x)));
+		return lhs_name(p) + " -> " + rhs_str(names);
+	}
+};
+
+// A read-only shared mapping of a whole file, so that processes using the
+// same table file share one copy of it in the page cache.
+class MappedFile {
+public:
+	MappedFile(const string& path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			throw runtime_error("cannot open " + path);
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
+			close(fd);
+			throw runtime_error("cannot map " + path);
+		}
+		len = st.st_size;
+		// an empty file is an empty mapping, mmap refuses length 0
+		if (len == 0) {
+			close(fd);
+			return;
+		}
+		addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+			throw runtime_error("cannot map " + path);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		if (addr) munmap(addr, len);
+	}
+
+	const void* data() const {
+		return addr;
+	}
+
+	size_t size() const {
+		return len;
+	}
+
+private:
+	void* addr = nullptr;
+	size_t len = 0;
+};
+
+// A token as a view into the input: terminal id, byte offset from the start
+// of the input and length. kind is Lexer::ERR where no terminal matches.
+struct TokenView {
+	int kind;
+	uint64_t offset;
+	uint32_t length;
+};
+
+// Input for StreamLexer read a chunk at a time from a stream.
+struct IstreamSource {
+	static constexpr bool in_place = false;
+	istream& in;
+
+	size_t read(char* buf, size_t n) {
+		in.read(buf, n);
+		return in.gcount();
+	}
+};
+
+// Input for StreamLexer read a chunk at a time from a file descriptor.
+struct FdSource {
+	static constexpr bool in_place = false;
+	int fd;
+
+	size_t read(char* buf, size_t n) {
+		while (true) {
+			ssize_t r = ::read(fd, buf, n);
+			if (r >= 0) return r;
+			if (errno != EINTR) throw runtime_error(string("read failed: ") + strerror(errno));
+		}
+	}
+};
+
+// Input for StreamLexer that is already in memory, such as a MappedFile,
+// and is lexed where it is.
+struct MemorySource {
+	static constexpr bool in_place = true;
+	const char* data;
+	size_t size;
+};
+
+// Lexes like Lexer, but takes its input from a Source as it goes and never
+// copies it. Chunked sources are read into a window that is refilled when
+// it runs out, keeping the unread tail so that no token is cut in two, and
+// grown if a single token fills it; tokens come out as (kind, offset,
+// length) views.
+template <class Source>
+class StreamLexer {
+public:
+	StreamLexer(Source& src, const vector<string>& terminals, const TokenDfa& tokenDfa, size_t chunkSize = 1 << 16)
+		:source(src), terminals(terminals), dfa(tokenDfa), eoi(terminals.size() - 1) {
+		if constexpr (Source::in_place) {
+			window = src.data;
+			end = src.size;
+			done = true;
+		} else {
+			buffer.resize(max<size_t>(chunkSize, 1));
+			window = buffer.data();
+		}
+	}
+
+	int next() {
+		return next_token().kind;
+	}
+
+	TokenView next_token() {
+		while (true) {
+			cur += skip_blanks(window + cur, end - cur);
+			if (cur < end || !refill()) break;
+		}
+		start = base + cur;
+		if (cur == end) return {eoi, base + cur, 0};
+
+		int token;
+		bool live;
+		size_t len = dfa.match(window + cur, end - cur, token, live);
+		// a match running into the end of the window may go on in the next chunk
+		while (live && refill())
+			len = dfa.match(window + cur, end - cur, token, live);
+		TokenView v {token, base + cur, static_cast<uint32_t>(token == Lexer::ERR ? 1 : len)};
+		cur += len;
+		return v;
+	}
+
+	// Text of the token last returned by next_token(), valid until the
+	// next call.
+	string_view text(const TokenView& t) const {
+		return string_view(window + (t.offset - base), t.length);
+	}
+
+	// Bytes consumed so far.
+	uint64_t offset() const {
+		return base + cur;
+	}
+
+	uint64_t token_begin() const {
+		return start;
+	}
+
+private:
+	// Moves the unread tail to the front of the buffer and reads one more
+	// chunk after it. False once the source is exhausted.
+	bool refill() {
+		if constexpr (Source::in_place) {
+			return false;
+		} else {
+			if (done) return false;
+			size_t tail = end - cur;
+			if (tail == buffer.size()) {
+				buffer.resize(2 * buffer.size());
+				window = buffer.data();
+			}
+			memmove(buffer.data(), buffer.data() + cur, tail);
+			base += cur;
+			cur = 0;
+			end = tail;
+			size_t n = source.read(buffer.data() + end, buffer.size() - end);
+			if (n == 0) done = true;
+			end += n;
+			return n > 0;
+		}
+	}
+
+	Source& source;
+	const vector<string>& terminals;
+	const TokenDfa& dfa;
+	int eoi;
+	vector<char> buffer;
+	const char* window = nullptr;
+	uint64_t base = 0;  // input offset of window[0]
+	uint64_t start = 0;
+	size_t cur = 0;
+	size_t end = 0;
+	bool done = false;
+};
+
+void write_table(const ParseTable& table, const string& path) {
+	vector<uint32_t> image = table.serialize();
+	ofstream out(path, ios::binary);
+	out.write(reinterpret_cast<const char*>(image.data()), image.size() * 4);
+	if (!out)
+		throw runtime_error("cannot write " + path);
+}
+
+// A C++ identifier for a symbol name: letters, digits and underscores are
+// kept and punctuation is spelled out, so '+' becomes PLUS and E' E_PRIME.
+string cpp_identifier(const string& name) {
+	static const map<char, string> punct = {
+		{'+', "PLUS"}, {'-', "MINUS"}, {'*', "STAR"}, {'/', "SLASH"}, {'%', "PERCENT"}, {'(', "LPAREN"}, {')', "RPAREN"},
+		{'[', "LBRACKET"}, {']', "RBRACKET"}, {'{', "LBRACE"}, {'}', "RBRACE"}, {'<', "LT"}, {'>', "GT"}, {'=', "EQ"},
+		{'!', "BANG"}, {'&', "AMP"}, {'|', "BAR"}, {'^', "CARET"}, {'~', "TILDE"}, {'.', "DOT"}, {',', "COMMA"},
+		{';', "SEMI"}, {':', "COLON"}, {'?', "QUESTION"}, {'@', "AT"}, {'#', "HASH"}, {'$', "END"}, {'\'', "PRIME"}
+	};
+	string id;
+	for (char c : name) {
+		if (isalnum(static_cast<unsigned char>(c)) || c == '_') {
+			if (!id.empty() && !isalnum(static_cast<unsigned char>(id.back())) && id.back() != '_') id += '_';
+			id += c;
+			continue;
+		}
+		auto it = punct.find(c);
+		string part = it != punct.end() ? it->second : "X" + to_string(static_cast<unsigned char>(c));
+		id += (id.empty() ? "" : "_") + part;
+	}
+	return id;
+}
+
+// Writes a standalone header for the table: the ACTION/GOTO tables as
+// constexpr arrays (action cells packed as in Action), terminal and
+// production enums, the lexer DFA with a longest-match next_token() and a
+// table driven parse(). With switch_states it also gets parse_switch(),
+// which codes every state as a case of a switch instead of reading the
+// action table.
+void emit_cpp(const ParseTable& table, ostream& out, const string& name, bool switch_states) {
+	const int T = table.num_terminals, N = table.num_non_terminals, P = table.productions.size();
+
+	vector<string> terminal_ids;
+	for (int t = 0; t < T; t++) {
+		string id = "TOK_" + cpp_identifier(table.symbol_names[t]);
+		if (find(terminal_ids.begin(), terminal_ids.end(), id) != terminal_ids.end()) id += "_" + to_string(t);
+		terminal_ids.push_back(id);
+	}
+
+	out << "// Generated by gen_lalr, do not edit.\n";
+	out << "#pragma once\n\n#include <cstdint>\n#include <vector>\n\n";
+	out << "namespace " << name << " {\n\n";
+	out << "inline constexpr int num_states = " << table.num_states << ";\n";
+	out << "inline constexpr int num_terminals = " << T << ";\n";
+	out << "inline constexpr int num_non_terminals = " << N << ";\n";
+	out << "inline constexpr int num_productions = " << P << ";\n\n";
+
+	out << "enum Terminal : int {\n";
+	for (int t = 0; t < T; t++)
+		out << "\t" << terminal_ids[t] << " = " << t << ",\n";
+	out << "};\n\n";
+
+	out << "enum Production : int {\n";
+	for (int p = 0; p < P; p++)
+		out << "\tP" << p << "_" << cpp_identifier(table.lhs_name(p)) << " = " << p << ",  // " << table.production_str(p) << "\n";
+	out << "};\n\n";
+
+	out << "inline constexpr const char* symbol_names[] = {";
+	for (int i = 0; i < table.symbol_names.size(); i++) {
+		string escaped;
+		for (char c : table.symbol_names[i]) escaped += (c == '"' || c == '\\' ? "\\" : "") + string(1, c);
+		out << (i ? ", " : "") << "\"" << escaped << "\"";
+	}
+	out << "};\n\n";
+
+	out << "// pop count and left hand side (GOTO column) of every production\n";
+	out << "inline constexpr int production_len[] = {";
+	for (int p = 0; p < P; p++) out << (p ? ", " : "") << table.productions[p].pop_amt;
+	out << "};\n";
+	out << "inline constexpr int production_lhs[] = {";
+	for (int p = 0; p < P; p++) out << (p ? ", " : "") << table.productions[p].lhs;
+	out << "};\n\n";
+
+	out << "// action kind in the top two bits (0 error, 1 shift, 2 reduce, 3 accept),\n";
+	out << "// shift state or production in the rest\n";
+	out << "inline constexpr uint32_t action[num_states][num_terminals] = {\n";
+	for (int s = 0; s < table.num_states; s++) {
+		out << "\t{";
+		for (int t = 0; t < T; t++) out << (t ? ", " : "") << "0x" << hex << table.action_at(s, t).word << dec;
+		out << "},\n";
+	}
+	out << "};\n\n";
+
+	out << "inline constexpr int32_t goto_table[num_states][num_non_terminals] = {\n";
+	for (int s = 0; s < table.num_states; s++) {
+		out << "\t{";
+		for (int n = 0; n < N; n++) out << (n ? ", " : "") << table.goto_at(s, n);
+		out << "},\n";
+	}
+	out << "};\n\n";
+
+	TokenDfa dfa = table.token_dfa();
+	out << "// lexer DFA: byte classes, transitions (state 0 is dead) and the terminal\n";
+	out << "// every state accepts, -1 if none\n";
+	out << "inline constexpr uint8_t byte_class[256] = {";
+	for (int b = 0; b < 256; b++) out << (b ? ", " : "") << int(dfa.byte_class[b]);
+	out << "};\n";
+	out << "inline constexpr int lexer_start = " << dfa.start << ";\n";
+	out << "inline constexpr int32_t lexer_next[][" << dfa.num_classes << "] = {\n";
+	for (int s = 0; s < dfa.num_states(); s++) {
+		out << "\t{";
+		for (int c = 0; c < dfa.num_classes; c++) out << (c ? ", " : "") << dfa.next[s * dfa.num_classes + c];
+		out << "},\n";
+	}
+	out << "};\n";
+	out << "inline constexpr int lexer_accept[] = {";
+	for (int s = 0; s < dfa.num_states(); s++) out << (s ? ", " : "") << dfa.accept[s];
+	out << "};\n\n";
+
+	out << "// Skips blanks and returns the longest match at cur, TOK_END at the end\n";
+	out << "// of the string and -1 if nothing matches.\n";
+	out << "inline int next_token(const char*& cur) {\n";
+	out << "\twhile (*cur == ' ' || *cur == '\\t' || *cur == '\\n' || *cur == '\\r') cur++;\n";
+	out << "\tif (*cur == '\\0') return " << terminal_ids[T - 1] << ";\n";
+	out << "\tint token = -1, len = 0;\n";
+	out << "\tfor (int s = lexer_start, n = 0; cur[n] != '\\0'; n++) {\n";
+	out << "\t\ts = lexer_next[s][byte_class[static_cast<unsigned char>(cur[n])]];\n";
+	out << "\t\tif (s == 0) break;\n";
+	out << "\t\tif (lexer_accept[s] != -1) {\n";
+	out << "\t\t\ttoken = lexer_accept[s];\n";
+	out << "\t\t\tlen = n + 1;\n";
+	out << "\t\t}\n";
+	out << "\t}\n";
+	out << "\tcur += len;\n";
+	out << "\treturn token;\n";
+	out << "}\n\n";
+
+	out << "// next() returns the next terminal (or -1 on a lexical error), on_reduce\n";
+	out << "// is called with every production reduced by, which gives a rightmost\n";
+	out << "// derivation in reverse.\n";
+	out << "template <class Next, class OnReduce>\n";
+	out << "bool parse(Next&& next, OnReduce&& on_reduce) {\n";
+	out << "\tstd::vector<int> stack {0};\n";
+	out << "\tint a = next();\n";
+	out << "\twhile (true) {\n";
+	out << "\t\tif (a < 0 || a >= num_terminals) return false;\n";
+	out << "\t\tuint32_t act = action[stack.back()][a];\n";
+	out << "\t\tint value = act & ((1u << 30) - 1);\n";
+	out << "\t\tswitch (act >> 30) {\n";
+	out << "\t\tcase 1:\n";
+	out << "\t\t\tstack.push_back(value);\n";
+	out << "\t\t\ta = next();\n";
+	out << "\t\t\tbreak;\n";
+	out << "\t\tcase 2:\n";
+	out << "\t\t\tstack.resize(stack.size() - production_len[value]);\n";
+	out << "\t\t\tif (goto_table[stack.back()][production_lhs[value]] < 0) return false;\n";
+	out << "\t\t\tstack.push_back(goto_table[stack.back()][production_lhs[value]]);\n";
+	out << "\t\t\ton_reduce(Production(value));\n";
+	out << "\t\t\tbreak;\n";
+	out << "\t\tcase 3:\n";
+	out << "\t\t\treturn true;\n";
+	out << "\t\tdefault:\n";
+	out << "\t\t\treturn false;\n";
+	out << "\t\t}\n";
+	out << "\t}\n";
+	out << "}\n";
+
+	if (switch_states) {
+		out << "\n// parse() with every state coded as a switch case.\n";
+		out << "template <class Next, class OnReduce>\n";
+		out << "bool parse_switch(Next&& next, OnReduce&& on_reduce) {\n";
+		out << "\tstd::vector<int> stack {0};\n";
+		out << "\tint a = next();\n";
+		out << "\tint p = 0;\n";
+		out << "\twhile (true) {\n";
+		out << "\t\tswitch (stack.back()) {\n";
+		for (int s = 0; s < table.num_states; s++) {
+			out << "\t\tcase " << s << ":\n";
+			out << "\t\t\tswitch (a) {\n";
+			// group the terminals by action so each action is coded once
+			map<uint32_t, vector<int>> by_action;
+			for (int t = 0; t < T; t++)
+				if (table.action_at(s, t).type() != Action::Error) by_action[table.action_at(s, t).word].push_back(t);
+			for (auto& kp : by_action) {
+				for (int t : kp.second) out << "\t\t\tcase " << terminal_ids[t] << ":\n";
+				Action act;
+				act.word = kp.first;
+				if (act.type() == Action::Shift) {
+					out << "\t\t\t\tstack.push_back(" << act.value() << ");\n";
+					out << "\t\t\t\ta = next();\n";
+					out << "\t\t\t\tcontinue;\n";
+				} else if (act.type() == Action::Reduce) {
+					out << "\t\t\t\tp = P" << act.value() << "_" << cpp_identifier(table.lhs_name(act.value())) << ";\n";
+					out << "\t\t\t\tbreak;\n";
+				} else {
+					out << "\t\t\t\treturn true;\n";
+				}
+			}
+			out << "\t\t\tdefault:\n";
+			out << "\t\t\t\treturn false;\n";
+			out << "\t\t\t}\n";
+			out << "\t\t\tbreak;\n";
+		}
+		out << "\t\tdefault:\n";
+		out << "\t\t\treturn false;\n";
+		out << "\t\t}\n";
+		out << "\t\tstack.resize(stack.size() - production_len[p]);\n";
+		out << "\t\tif (goto_table[stack.back()][production_lhs[p]] < 0) return false;\n";
+		out << "\t\tstack.push_back(goto_table[stack.back()][production_lhs[p]]);\n";
+		out << "\t\ton_reduce(Production(p));\n";
+		out << "\t}\n";
+		out << "}\n";
+	}
+
+	out << "\n}  // namespace " << name << "\n";
+}
+
+// A parse tree in one array, built bottom-up: a node is appended when its
+// children are done, so the nodes are in postorder and the subtree of node
+// n is the range of size nodes ending at n. Each node is a symbol and the
+// input bytes it covers, 16 bytes in all, and reuse only clears the array.
+// roots are the subtrees not yet given a parent, the value stack of the
+// parse.
+struct CompactTree {
+	struct Node {
+		int32_t symbol;
+		uint32_t size;   // nodes in the subtree, this one included
+		uint32_t begin;  // input bytes covered
+		uint32_t end;
+	};
+	static_assert(sizeof(Node) == 16);
+
+	vector<Node> nodes;
+	vector<int32_t> roots;
+
+	void clear() {
+		nodes.clear();
+		roots.clear();
+	}
+
+	// A leaf for a token.
+	void shift(int symbol, uint64_t begin, uint64_t end) {
+		roots.push_back(nodes.size());
+		nodes.push_back({symbol, 1, static_cast<uint32_t>(begin), static_cast<uint32_t>(end)});
+	}
+
+	// Makes the last n roots the children of a new node. An empty node sits
+	// where the input read so far ends.
+	void reduce(int symbol, int n) {
+		uint32_t at = nodes.empty() ? 0 : nodes.back().end;
+		Node node {symbol, 1, at, at};
+		if (n > 0) {
+			int first = roots[roots.size() - n];
+			node.size += nodes.size() - (first - nodes[first].size + 1);
+			node.begin = nodes[first].begin;
+			roots.resize(roots.size() - n);
+		}
+		roots.push_back(nodes.size());
+		nodes.push_back(node);
+	}
+
+	int last_child(int n) const {
+		return nodes[n].size > 1 ? n - 1 : -1;
+	}
+
+	// The child of parent before child, -1 for the first.
+	int prev_sibling(int parent, int child) const {
+		int c = child - nodes[child].size;
+		return c > parent - static_cast<int>(nodes[parent].size) ? c : -1;
+	}
+};
+
+// What Parser::parse did with one input.
+struct ParseResult {
+	bool accepted = false;
+	uint64_t steps = 0;
+	uint64_t tokens = 0;
+	uint64_t offset = 0;  // input consumed, up to the error if rejected
+};
+
+// What Parser::parse_batch did with one input, kept to 8 bytes.
+struct BatchResult {
+	uint32_t tokens;
+	int32_t error_at;  // input consumed when it was rejected, -1 if accepted
+
+	bool accepted() const {
+		return error_at == -1;
+	}
+};
+
+// Hooks Parser::parse calls on every step. NullTracer does nothing and
+// compiles away, so a parse without a trace pays no formatting cost.
+struct NullTracer {
+	template <class Lex>
+	void start(const printable_stack<int>& stack, const Lex& lex) {}
+	template <class Lex>
+	void shift(const printable_stack<int>& stack, int token, const Lex& lex, int state) {}
+	// shifted_state is the state shifted into in the same step, or -1;
+	// skipped holds the unit productions passed through after the goto.
+	template <class Lex>
+	void reduce(const printable_stack<int>& stack, int lookahead, const Lex& lex, int production, int shifted_state, const vector<int>& skipped) {}
+	template <class Lex>
+	void accept(const printable_stack<int>& stack, int token, const Lex& lex) {}
+	// token is Lexer::ERR if the input could not be lexed
+	template <class Lex>
+	void error(int token, const Lex& lex) {}
+};
+
+// What Parser::run builds as it goes: a leaf for every token shifted and a
+// node for every reduction by production over the last n values, with
+// symbol its left hand side. skip_unit is a unit production the optimized
+// modes pass through without a reduce. NullBuilder builds nothing.
+struct NullBuilder {
+	void shift(int terminal, uint64_t begin, uint64_t end) {}
+	void reduce(int production, int symbol, int n) {}
+	void skip_unit(int production, int symbol) {}
+};
+
+// Builds a CompactTree. A skipped unit's node is left out and its child
+// takes its place, unless the units are kept.
+struct TreeBuilder {
+	CompactTree& tree;
+	bool keep_units;
+
+	void shift(int terminal, uint64_t begin, uint64_t end) {
+		tree.shift(terminal, begin, end);
+	}
+
+	void reduce(int production, int symbol, int n) {
+		tree.reduce(symbol, n);
+	}
+
+	void skip_unit(int production, int symbol) {
+		if (keep_units) tree.reduce(symbol, 1);
+	}
+};
+
+// Semantic actions by production id over values of type V. A token's value
+// is on_token(terminal, text); a reduction by p replaces the values of its
+// right hand side with on_reduce[p](values), and without an action with the
+// first of them ($$ = $1), or V() for an empty production.
+template <class V>
+struct SemanticActions {
+	typedef function<V(int terminal, string_view text)> TokenAction;
+	typedef function<V(span<V> rhs)> ReduceAction;
+
+	TokenAction on_token;
+	vector<ReduceAction> on_reduce;
+
+	void on(int production, ReduceAction action) {
+		if (production >= on_reduce.size()) on_reduce.resize(production + 1);
+		on_reduce[production] = move(action);
+	}
+};
+
+// Runs SemanticActions as a builder, on a stack of values parallel to the
+// parse stack. Skipped units still run their action, if they have one.
+template <class V>
+struct ValueStack {
+	const SemanticActions<V>& actions;
+	string_view input;
+	vector<V> stack;
+
+	ValueStack(const SemanticActions<V>& semanticActions, string_view text)
+		:actions(semanticActions), input(text) {
+	}
+
+	void shift(int terminal, uint64_t begin, uint64_t end) {
+		stack.push_back(actions.on_token(terminal, input.substr(begin, end - begin)));
+	}
+
+	void reduce(int production, int symbol, int n) {
+		bool has_action = production < actions.on_reduce.size() && actions.on_reduce[production];
+		if (!has_action && n == 1) return;
+		V value = has_action ? actions.on_reduce[production](span<V>(stack.data() + stack.size() - n, n)) : n > 0 ? move(stack[stack.size() - n]) : V();
+		stack.erase(stack.end() - n, stack.end());
+		stack.push_back(move(value));
+	}
+
+	void skip_unit(int production, int symbol) {
+		reduce(production, symbol, 1);
+	}
+};
+
+// One step of a parse as a 24 byte record: a shifted terminal or a reduced
+// production with the input bytes it covers, or the end of the parse. The
+// span is kept as two offsets since the outer reductions of a streamed
+// input can cover more than 4 GiB.
+struct ParseEvent {
+	enum Kind : uint32_t {
+		Shift,
+		Reduce,
+		Accept,
+		Error  // begin is where the parse stopped
+	};
+
+	uint32_t word;  // kind in the top two bits, terminal or production below, as in Action
+	uint64_t begin;
+	uint64_t end;
+
+	ParseEvent() = default;
+	ParseEvent(Kind k, int id, uint64_t from, uint64_t to)
+		:word((static_cast<uint32_t>(k) << 30) | (static_cast<uint32_t>(id) & Action::VALUE_MASK)), begin(from), end(to) {
+	}
+
+	Kind kind() const {
+		return static_cast<Kind>(word >> 30);
+	}
+
+	int id() const {
+		return word & Action::VALUE_MASK;
+	}
+};
+
+// Reports the steps of Parser::run to a visitor with shift(terminal, begin,
+// end), reduce(production, begin, end), accept() and error(offset). The
+// span of a reduction runs from the start of its first symbol to the end of
+// the last token shifted, so only a start per stack entry is kept. Skipped
+// unit productions are reported as reductions over their child's span.
+template <class Visitor>
+struct EventBuilder {
+	Visitor& visitor;
+	vector<uint64_t> begins;
+	uint64_t end = 0;
+
+	void shift(int terminal, uint64_t begin, uint64_t tokenEnd) {
+		begins.push_back(begin);
+		end = tokenEnd;
+		visitor.shift(terminal, begin, end);
+	}
+
+	void reduce(int production, int symbol, int n) {
+		uint64_t begin = n > 0 ? begins[begins.size() - n] : end;
+		begins.resize(begins.size() - n);
+		begins.push_back(begin);
+		visitor.reduce(production, begin, end);
+	}
+
+	void skip_unit(int production, int symbol) {
+		visitor.reduce(production, begins.back(), end);
+	}
+};
+
+// A ring of ParseEvents between one producer and one consumer thread: a
+// visitor for Parser::parse_events that waits while the ring is full, and
+// pop() for the consumer, so events are taken while the parser runs and
+// memory stays at the ring's capacity.
+class EventRing {
+public:
+	EventRing(size_t capacity)
+		:events(bit_ceil(max<size_t>(capacity, 2))), mask(events.size() - 1) {
+	}
+
+	EventRing(const EventRing&) = delete;
+
+	void shift(int terminal, uint64_t begin, uint64_t end) {
+		push(ParseEvent(ParseEvent::Shift, terminal, begin, end));
+	}
+
+	void reduce(int production, uint64_t begin, uint64_t end) {
+		push(ParseEvent(ParseEvent::Reduce, production, begin, end));
+	}
+
+	void accept() {
+		push(ParseEvent(ParseEvent::Accept, 0, 0, 0));
+	}
+
+	void error(uint64_t offset) {
+		push(ParseEvent(ParseEvent::Error, 0, offset, offset));
+	}
+
+	// The next event, false if none is ready yet. Accept or Error is last.
+	bool pop(ParseEvent& event) {
+		size_t t = tail.load(memory_order_relaxed);
+		if (t == head.load(memory_order_acquire)) return false;
+		event = events[t & mask];
+		tail.store(t + 1, memory_order_release);
+		return true;
+	}
+
+private:
+	void push(const ParseEvent& event) {
+		size_t h = head.load(memory_order_relaxed);
+		while (h - tail.load(memory_order_acquire) == events.size()) this_thread::yield();
+		events[h & mask] = event;
+		head.store(h + 1, memory_order_release);
+	}
+
+	vector<ParseEvent> events;
+	size_t mask;
+	// apart, so producer and consumer don't share a cache line
+	alignas(64) atomic<size_t> head {0};
+	alignas(64) atomic<size_t> tail {0};
+};
+
+// Prints the Stack / Current Token / Input / Action table, one row per step.
+class TablePrinter {
+public:
+	TablePrinter(const TableView& tableView)
+		:table(tableView) {
+	}
+
+	void start(const printable_stack<int>& stack, const Lexer& lex) {
+		cout << left << setw(25) << "Stack"     << setw(25) << "Current Token" << setw(25) << "Input" << setw(25) << "Action" << endl;
+		cout << left << setw(25) << stack       << setw(25) << "- "            << setw(25) << lex     << setw(25) << "-"<< endl;
+	}
+
+	void shift(const printable_stack<int>& stack, int token, const Lexer& lex, int state) {
+		cout << left << setw(25) << stack << setw(25) << lex.token_str(token) << setw(25) << lex << setw(25) << "Shift to " + to_string(state) << endl;
+	}
+
+	void reduce(const printable_stack<int>& stack, int lookahead, const Lexer& lex, int production, int shifted_state, const vector<int>& skipped) {
+		string action = shifted_state == -1 ? "Reduce by " : "Shift to " + to_string(shifted_state) + ", reduce by ";
+		action += table.production_str(production);
+		for (int u : skipped) action += ", skip " + table.production_str(u);
+		cout << left << setw(25) << stack << setw(25) << (lookahead < 0 ? "-" : lex.token_str(lookahead)) << setw(25) << lex << setw(25) << action << endl;
+	}
+
+	void accept(const printable_stack<int>& stack, int token, const Lexer& lex) {
+		cout << left << setw(25) << stack << setw(25) << lex.token_str(token) << setw(25) << lex << setw(25) << "Accepted" << endl;
+	}
+
+	void error(int token, const Lexer& lex) {
+		if (token == Lexer::ERR) {
+			cout << "Lex error: " << endl;
+			lex.display_current_state("error occured while trying to lex.");
+			return;
+		}
+		cout << "Encountered error while parsing : Unexpected token " << lex.token_str(token) << endl;
+		lex.display_current_state("Parse error");
+	}
+
+private:
+	const TableView& table;
+};
+
+class Parser {
+public:
+	// Plain does every action the table asks for. Optimized does the
+	// reduction of a state whose only action is that reduction without
+	// reading the lookahead, in the same step as the shift into the state,
+	// and passes through states that would only reduce by a unit production
+	// (T -> F) by taking the goto on its left hand side right away. The unit
+	// nodes stay in the parse tree with OptimizedKeepUnits, otherwise the
+	// node takes the name of the symbol below it.
+	enum Mode {
+		Plain,
+		Optimized,
+		OptimizedKeepUnits
+	};
+
+	// Runs on a copy of the table in the binary format.
+	Parser(const ParseTable& parseTable, Mode m = Plain)
+		:image(parseTable.serialize()), table(image.data(), image.size() * 4), mode(m) {
+		init();
+	}
+
+	// Runs on the table in place, e.g. a mapped table file.
+	Parser(const TableView& tableView, Mode m = Plain)
+		:table(tableView), mode(m) {
+		init();
+	}
+
+	// table may point into image
+	Parser(const Parser&) = delete;
+
+	const TableView& view() const {
+		return table;
+	}
+
+	Mode parse_mode() const {
+		return mode;
+	}
+
+	ParseResult parse(const string& input) {
+		NullTracer tracer;
+		return parse(input, tracer);
+	}
+
+	template <class Tracer>
+	ParseResult parse(const string& input, Tracer& tracer) {
+		Lexer lex(input, terminals, dfa);
+		tree.clear();
+		TreeBuilder builder {tree, mode == OptimizedKeepUnits};
+		ParseResult result = run(lex, tracer, builder);
+		accepted = result.accepted;
+		return result;
+	}
+
+	// Parses input running the semantic actions on every shift and reduce,
+	// without a tree. After an accept value is the value of the start symbol.
+	template <class V>
+	ParseResult evaluate(string_view input, const SemanticActions<V>& actions, V& value) {
+		Lexer lex(input, terminals, dfa);
+		NullTracer tracer;
+		ValueStack<V> values(actions, input);
+		ParseResult result = run(lex, tracer, values);
+		if (result.accepted) value = move(values.stack.back());
+		return result;
+	}
+
+	// Parses every input on its own with the same stacks, which are reset
+	// but keep their storage, so only the result array is allocated.
+	vector<BatchResult> parse_batch(span<const string_view> inputs) {
+		vector<BatchResult> results(inputs.size());
+		parse_batch(inputs, results);
+		return results;
+	}
+
+	// The same into results, which needs room for every input.
+	void parse_batch(span<const string_view> inputs, span<BatchResult> results) {
+		NullTracer tracer;
+		NullBuilder no_tree;
+		for (size_t i = 0; i < inputs.size(); i++) {
+			Lexer lex(inputs[i], terminals, dfa);
+			ParseResult r = run(lex, tracer, no_tree);
+			results[i] = {static_cast<uint32_t>(r.tokens), r.accepted ? -1 : static_cast<int32_t>(r.offset)};
+		}
+	}
+
+	// Parses everything the source yields. No productions are kept for a
+	// parse tree, so memory only grows with the depth of the parse stack.
+	template <class Source>
+	ParseResult parse_stream(Source& source) {
+		StreamLexer<Source> lex(source, terminals, dfa);
+		NullTracer tracer;
+		NullBuilder no_tree;
+		return run(lex, tracer, no_tree);
+	}
+
+	// Parses everything the source yields, telling visitor (see
+	// EventBuilder) about every step as it happens. Nothing is collected.
+	template <class Source, class Visitor>
+	ParseResult parse_events(Source& source, Visitor& visitor) {
+		StreamLexer<Source> lex(source, terminals, dfa);
+		NullTracer tracer;
+		EventBuilder<Visitor> events {visitor};
+		ParseResult result = run(lex, tracer, events);
+		if (result.accepted)
+			visitor.accept();
+		else
+			visitor.error(result.offset);
+		return result;
+	}
+
+	template <class Lex, class Tracer, class Builder>
+	ParseResult run(Lex& lex, Tracer& tracer, Builder& builder) {
+		parse_stack.clear();
+		parse_stack.push(0);
+		tracer.start(parse_stack, lex);
+		ParseResult result;
+		// the lookahead is read when an action needs it
+		int a = NONE;
+		while (true) {
+			result.steps++;
+			int s = parse_stack.top();
+			Action act;
+			if (mode != Plain && table.consistent_reduction(s)) {
+				act = table.default_action[s];
+			} else {
+				if (a == NONE) a = lex.next();
+				if (a == Lexer::ERR) {
+					tracer.error(a, lex);
+					result.offset = lex.offset();
+					return result;
+				}
+				act = table.action_at(s, a);
+			}
+
+			int shifted_state = -1;
+			if (act.type() == Action::Shift) {
+				parse_stack.push(act.value());
+				builder.shift(a, lex.token_begin(), lex.offset());
+				result.tokens++;
+				if (mode == Plain || !table.consistent_reduction(act.value())) {
+					tracer.shift(parse_stack, a, lex, act.value());
+					a = NONE;
+					continue;
+				}
+				// reduce in the same step
+				shifted_state = act.value();
+				act = table.default_action[shifted_state];
+			}
+
+			if (act.type() == Action::Reduce) {
+				int p = act.value();
+				const ProductionInfo& prod = table.production(p);
+				for (int i = 0; i < prod.pop_amt; i++) parse_stack.pop();
+				int t = parse_stack.top();
+				int g = table.goto_at(t, prod.lhs);
+				if (g == -1) {
+					tracer.error(a, lex);
+					result.offset = lex.offset();
+					return result;
+				}
+				builder.reduce(p, table.num_terminals + prod.lhs, prod.pop_amt);
+				skipped.clear();
+				if (mode != Plain) {
+					for (int u = table.unit_reduction(g); u != -1; u = table.unit_reduction(g)) {
+						builder.skip_unit(u, table.num_terminals + table.production(u).lhs);
+						skipped.push_back(u);
+						g = table.goto_at(t, table.production(u).lhs);
+					}
+				}
+				parse_stack.push(g);
+				tracer.reduce(parse_stack, a, lex, p, shifted_state, skipped);
+				if (shifted_state != -1) a = NONE;
+			} else if (act.type() == Action::Accept) {
+				tracer.accept(parse_stack, a, lex);
+				result.tokens++;
+				result.accepted = true;
+				result.offset = lex.offset();
+				return result;
+			} else {
+				tracer.error(a, lex);
+				result.offset = lex.offset();
+				return result;
+			}
+		}
+	}
+
+	// The tree of the last input parsed with parse(), valid until the next
+	// parse. Its roots are the start symbol after an accept, otherwise the
+	// subtrees that were on the stack when the parse stopped.
+	const CompactTree& compact_tree() const {
+		return tree;
+	}
+
+	// compact_tree() with names for drawing. A partial tree hangs off an
+	// <incomplete> root.
+	Tree parse_tree() const {
+		if (accepted) return Tree(tree_node(tree.roots[0]));
+		Tree partial("<incomplete>");
+		for (int r : tree.roots) partial.root.children.push_back(tree_node(r));
+		return partial;
+	}
+
+private:
+	printable_stack<int> parse_stack;
+	vector<uint32_t> image;
+	TableView table;
+	vector<string> terminals;
+	TokenDfa dfa;
+	CompactTree tree;
+	bool accepted = false;
+	vector<int> skipped;
+	Mode mode;
+
+	// no lookahead read yet
+	static const int NONE = -2;
+
+	Tree::TreeNode tree_node(int n) const {
+		Tree::TreeNode node(string(table.symbol_name(tree.nodes[n].symbol)));
+		for (int c = tree.last_child(n); c != -1; c = tree.prev_sibling(n, c))
+			node.children.push_back(tree_node(c));
+		reverse(node.children.begin(), node.children.end());
+		// a nonterminal without children derived epsilon
+		if (node.children.empty() && tree.nodes[n].symbol >= table.num_terminals) node.add_child("%empty");
+		return node;
+	}
+
+	void init() {
+		vector<string> patterns;
+		for (int i = 0; i < table.num_terminals; i++) {
+			terminals.push_back(string(table.symbol_name(i)));
+			patterns.push_back(string(table.token_pattern(i)));
+		}
+		dfa = TokenDfa(terminals, patterns);
+		parse_stack.reserve(256);
+	}
+};
+
+// Parses batches on a pool of worker threads sharing one read-only table.
+// Each worker has its own Parser, so its own stacks and lexer DFA. A batch
+// is cut into shards of consecutive inputs, dealt out to per-worker deques;
+// a worker takes shards from the back of its own and, once that is empty,
+// steals from the front of the others'.
+class ParseService {
+public:
+	// Per worker counters of the last parse(), each on its own cache line.
+	struct alignas(64) WorkerStats {
+		uint64_t inputs = 0;
+		uint64_t tokens = 0;
+		uint64_t bytes = 0;
+		uint64_t shards = 0;
+		uint64_t stolen = 0;  // shards taken from another worker
+		double ms = 0;
+	};
+
+	// table has to outlive the service.
+	ParseService(const TableView& table, int threads, Parser::Mode mode = Parser::Plain)
+		:queues(max(threads, 1)), worker_stats(max(threads, 1)) {
+		for (int i = 0; i < queues.size(); i++) parsers.push_back(make_unique<Parser>(table, mode));
+	}
+
+	int threads() const {
+		return parsers.size();
+	}
+
+	// Results in the order of the inputs, as Parser::parse_batch.
+	vector<BatchResult> parse(span<const string_view> inputs) {
+		vector<BatchResult> results(inputs.size());
+		int n = threads();
+		// a few shards per worker for stealing to even out
+		size_t shard_size = max<size_t>(64, inputs.size() / (16 * n));
+		size_t per_worker = (inputs.size() + n - 1) / n;
+		for (int w = 0; w < n; w++) {
+			worker_stats[w] = WorkerStats();
+			size_t end = min(inputs.size(), (w + 1) * per_worker);
+			for (size_t begin = w * per_worker; begin < end; begin += shard_size)
+				queues[w].shards.push_back({begin, min(end, begin + shard_size)});
+		}
+		vector<thread> workers;
+		for (int w = 0; w < n; w++)
+			workers.emplace_back([this, w, inputs, &results] { work(w, inputs, results); });
+		for (auto& t : workers) t.join();
+		return results;
+	}
+
+	const vector<WorkerStats>& stats() const {
+		return worker_stats;
+	}
+
+private:
+	struct Shard {
+		size_t begin;
+		size_t end;
+	};
+
+	struct ShardQueue {
+		mutex lock;
+		deque<Shard> shards;
+	};
+
+	void work(int w, span<const string_view> inputs, span<BatchResult> results) {
+		auto start = chrono::steady_clock::now();
+		WorkerStats& stats = worker_stats[w];
+		Shard shard;
+		while (take(w, shard)) {
+			span<const string_view> in = inputs.subspan(shard.begin, shard.end - shard.begin);
+			span<BatchResult> out = results.subspan(shard.begin, shard.end - shard.begin);
+			parsers[w]->parse_batch(in, out);
+			stats.shards++;
+			stats.inputs += in.size();
+			for (size_t i = 0; i < in.size(); i++) {
+				stats.tokens += out[i].tokens;
+				stats.bytes += in[i].size();
+			}
+		}
+		stats.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	bool take(int w, Shard& shard) {
+		{
+			lock_guard<mutex> guard(queues[w].lock);
+			if (!queues[w].shards.empty()) {
+				shard = queues[w].shards.back();
+				queues[w].shards.pop_back();
+				return true;
+			}
+		}
+		for (int i = 1; i < queues.size(); i++) {
+			ShardQueue& victim = queues[(w + i) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if (!victim.shards.empty()) {
+				shard = victim.shards.front();
+				victim.shards.pop_front();
+				worker_stats[w].stolen++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	vector<unique_ptr<Parser>> parsers;
+	vector<ShardQueue> queues;
+	vector<WorkerStats> worker_stats;
+};
+
+typedef pair<string, string> production;
+typedef pair<string, vector<string>> rule;
+
+struct Production {
+	SymbolId lhs;
+	vector<SymbolId> rhs;
+};
+
+struct Item {
+	Item(int p, SymbolId la) : production(p), dot_idx(0), lookahead(la) {}
+	Item(int p, int di, SymbolId la) : production(p), dot_idx(di), lookahead(la) {}
+
+	bool operator==(const Item& other) const {
+		return (production == other.production) && (dot_idx == other.dot_idx) && (lookahead == other.lookahead);
+	}
+
+	bool operator<(const Item& other) const {
+		return tie(production, dot_idx, lookahead) < tie(other.production, other.dot_idx, other.lookahead);
+	}
+
+	uint64_t key() const {
+		return (static_cast<uint64_t>(production) << 40) | (static_cast<uint64_t>(dot_idx) << 24) | static_cast<uint64_t>(lookahead);
+	}
+
+	int production;
+	int dot_idx;
+	SymbolId lookahead;
+};
+
+struct ItemHash {
+	size_t operator()(const Item& i) const {
+		uint64_t k = i.key() * 0x9E3779B97F4A7C15ull;
+		return k ^ (k >> 29);
+	}
+};
+
+// Hash of a sorted kernel, the key of the state registry.
+struct KernelHash {
+	size_t operator()(const vector<Item>& kernel) const {
+		size_t h = kernel.size();
+		for (auto& i : kernel) h = (h * 1000003u) ^ ItemHash()(i);
+		return h;
+	}
+};
+
+struct Grammar {
+	// How the item sets are built: the canonical LR(1) collection with every
+	// closure stored, the same collection keeping only kernels, or LALR(1)
+	// states built straight from the LR(0) automaton.
+	enum ItemSetMode {
+		Canonical,
+		KernelOnly,
+		DirectLALR
+	};
+
+	Grammar(vector<production> p, ItemSetMode m = Canonical) : Grammar(split_productions(p), m) {
+	}
+
+	// Productions whose right hand sides are already split into symbol names,
+	// the first one being the augmented start production.
+	Grammar(vector<rule> split, ItemSetMode m = Canonical) : mode(m) {
+		set<string> lhs_names;
+		for (auto& i : split)
+			lhs_names.insert(i.first);
+
+		// Every name that never shows up on a left hand side is a terminal,
+		// terminals get interned first so their ids are the ACTION columns.
+		vector<string> terminal_names;
+		for (auto& i : split)
+			for (auto& x : i.second)
+				if (lhs_names.find(x) == lhs_names.end() && find(terminal_names.begin(), terminal_names.end(), x) == terminal_names.end())
+					terminal_names.push_back(x);
+		terminal_names.push_back("$");
+		for (auto& t : terminal_names)
+			symbols.intern(t);
+		symbols.num_terminals = terminal_names.size();
+		for (auto& i : split)
+			symbols.intern(i.first);
+
+		for (auto& i : split) {
+			Production prod {symbols.find(i.first), {}};
+			for (auto& x : i.second)
+				prod.rhs.push_back(symbols.find(x));
+			productions.push_back(prod);
+		}
+		lhs_productions.resize(symbols.size());
+		for (int i = 0; i < productions.size(); i++)
+			lhs_productions[productions[i].lhs].push_back(i);
+		eoi = symbols.find("$");
+		compute_first_sets();
+		if (mode == DirectLALR)
+			generate_lalr1_items();
+		else
+			generate_lr1_items();
+	}
+
+	static vector<rule> split_productions(const vector<production>& p) {
+		set<string> lhs_names;
+		for (auto& i : p)
+			lhs_names.insert(i.first);
+		vector<rule> split;
+		for (auto& i : p)
+			split.push_back({i.first, split_symbols(i.second, lhs_names)});
+		return split;
+	}
+
+	// Splits a right hand side into symbol names. Whitespace separated right
+	// hand sides are taken as they are, otherwise the longest nonterminal name
+	// wins, a run of lowercase letters is one terminal (like id) and anything
+	// else is a single character terminal.
+	static vector<string> split_symbols(const string& rhs, const set<string>& non_terminals) {
+		vector<string> names;
+		if (rhs.find_first_of(" \t") != string::npos) {
+			stringstream ss(rhs);
+			string name;
+			while (ss >> name) names.push_back(name);
+			return names;
+		}
+
+		for (size_t i = 0; i < rhs.size();) {
+			size_t len = 0;
+			for (auto& nt : non_terminals)
+				if (nt.size() > len && rhs.compare(i, nt.size(), nt) == 0) len = nt.size();
+			if (len == 0)
+				while (i + len < rhs.size() && islower(rhs[i + len])) len++;
+			if (len == 0) len = 1;
+			names.push_back(rhs.substr(i, len));
+			i += len;
+		}
+		return names;
+	}
+
+	// FIRST and NULLABLE of every nonterminal as one fixpoint over the
+	// productions, then FIRST / NULLABLE of every production suffix so that
+	// closures only ever read precomputed sets.
+	void compute_first_sets() {
+		first_sets.assign(symbols.num_non_terminals(), TerminalSet(symbols.num_terminals));
+		nullable.assign(symbols.size(), false);
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (auto& p : productions) {
+				TerminalSet& f = first_sets[p.lhs - symbols.num_terminals];
+				bool all_nullable = true;
+				for (SymbolId x : p.rhs) {
+					if (symbols.is_terminal(x)) {
+						if (!f.contains(x)) {
+							f.insert(x);
+							changed = true;
+						}
+						all_nullable = false;
+						break;
+					}
+					changed |= f.or_with(first_sets[x - symbols.num_terminals]);
+					if (!nullable[x]) {
+						all_nullable = false;
+						break;
+					}
+				}
+				if (all_nullable && !nullable[p.lhs])
+					nullable[p.lhs] = changed = true;
+			}
+		}
+
+		suffix_first.clear();
+		suffix_nullable.clear();
+		for (auto& p : productions) {
+			int n = p.rhs.size();
+			vector<TerminalSet> f(n + 1, TerminalSet(symbols.num_terminals));
+			vector<bool> nl(n + 1, true);
+			for (int k = n - 1; k >= 0; k--) {
+				nl[k] = first(&p.rhs[k], &p.rhs[k] + 1, f[k]);
+				if (nl[k]) {
+					f[k].or_with(f[k + 1]);
+					nl[k] = nl[k + 1];
+				}
+			}
+			suffix_first.push_back(f);
+			suffix_nullable.push_back(nl);
+		}
+	}
+
+	// ORs FIRST of the symbols in [begin, end) into out and returns whether
+	// the whole sequence can derive the empty string.
+	bool first(const SymbolId* begin, const SymbolId* end, TerminalSet& out) const {
+		for (const SymbolId* x = begin; x != end; x++) {
+			if (symbols.is_terminal(*x)) {
+				out.insert(*x);
+				return false;
+			}
+			out.or_with(first_sets[*x - symbols.num_terminals]);
+			if (!nullable[*x]) return false;
+		}
+		return true;
+	}
+
+	// Calls f with every lookahead an item pulls into a closure for the
+	// symbol after its dot: FIRST of the rest of the rhs, plus the item's own
+	// lookahead when that rest is nullable.
+	template <class F>
+	void closure_lookaheads(const Item& item, F f) const {
+		suffix_first[item.production][item.dot_idx + 1].for_each(f);
+		if (suffix_nullable[item.production][item.dot_idx + 1] && !suffix_first[item.production][item.dot_idx + 1].contains(item.lookahead))
+			f(item.lookahead);
+	}
+
+	// I doubles as the worklist: every item is expanded exactly once when
+	// the scan reaches it, and items already in the set are found by hash.
+	vector<Item> closure(vector<Item> I) {
+		unordered_set<Item, ItemHash> seen(I.begin(), I.end());
+		for (int i = 0; i < I.size(); i++) {
+			Item item = I[i];
+			const Production& ip = productions[item.production];
+			if (item.dot_idx >= ip.rhs.size() || symbols.is_terminal(ip.rhs[item.dot_idx])) continue;
+
+			for (int p : lhs_productions[ip.rhs[item.dot_idx]]) {
+				closure_lookaheads(item, [&](SymbolId k) {
+					auto u = Item(p, k);
+					if (seen.insert(u).second) I.push_back(u);
+				});
+			}
+		}
+		return I;
+	}
+
+	// What closing over a nonterminal B adds, whatever state it happens in:
+	// every nonterminal C that can start a derivation of B, the lookaheads C
+	// always gets and whether it also inherits the lookaheads B came with.
+	struct Expansion {
+		SymbolId nt;
+		TerminalSet spontaneous;
+		bool inherits;
+	};
+
+	// Kernel-only grammars compute the expansion of every nonterminal once
+	// and assemble state closures from it.
+	const vector<Expansion>& expansion(SymbolId B) {
+		if (expansion_cache.empty()) expansion_cache.resize(symbols.num_non_terminals());
+		auto& e = expansion_cache[B - symbols.num_terminals];
+		if (!e.empty()) return e;
+
+		map<SymbolId, int> index {{B, 0}};
+		e.push_back({B, TerminalSet(symbols.num_terminals), true});
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (int i = 0; i < e.size(); i++) {
+				for (int p : lhs_productions[e[i].nt]) {
+					auto& rhs = productions[p].rhs;
+					if (rhs.empty() || symbols.is_terminal(rhs[0])) continue;
+					if (index.find(rhs[0]) == index.end()) {
+						index[rhs[0]] = e.size();
+						e.push_back({rhs[0], TerminalSet(symbols.num_terminals), false});
+						changed = true;
+					}
+					bool tail_nullable = suffix_nullable[p][1];
+					bool inherits = tail_nullable && e[i].inherits;
+					Expansion& d = e[index[rhs[0]]];
+					bool added = d.spontaneous.or_with(suffix_first[p][1]);
+					if (tail_nullable) added |= d.spontaneous.or_with(e[i].spontaneous);
+					if (added || (inherits && !d.inherits)) {
+						d.inherits = d.inherits || inherits;
+						changed = true;
+					}
+				}
+			}
+		}
+		return e;
+	}
+
+	vector<Item> kernel_closure(const vector<Item>& kernel) {
+		vector<Item> I = kernel;
+		unordered_set<Item, ItemHash> seen(I.begin(), I.end());
+		map<SymbolId, TerminalSet> expanded;
+		for (auto& item : kernel) {
+			const Production& ip = productions[item.production];
+			if (item.dot_idx >= ip.rhs.size() || symbols.is_terminal(ip.rhs[item.dot_idx])) continue;
+			auto it = expanded.emplace(ip.rhs[item.dot_idx], TerminalSet(symbols.num_terminals)).first;
+			closure_lookaheads(item, [&](SymbolId k) { it->second.insert(k); });
+		}
+		TerminalSet la(symbols.num_terminals);
+		for (auto& kv : expanded) {
+			for (auto& e : expansion(kv.first)) {
+				la = e.spontaneous;
+				if (e.inherits) la.or_with(kv.second);
+				for (int p : lhs_productions[e.nt])
+					la.for_each([&](SymbolId k) {
+						if (seen.insert(Item(p, k)).second) I.push_back(Item(p, k));
+					});
+			}
+		}
+		return I;
+	}
+
+	int num_states() const {
+		return kernels.size();
+	}
+
+	// The closed item set of a state. Unless the grammar is Canonical it is
+	// computed on first use and kept until clear_closure_cache().
+	const vector<Item>& state_items(int state) {
+		if (mode == Canonical) return item_set[state];
+		if (closure_cache.size() < kernels.size()) closure_cache.resize(kernels.size());
+		if (closure_cache[state].empty()) closure_cache[state] = kernel_closure(kernels[state]);
+		return closure_cache[state];
+	}
+
+	void clear_closure_cache() {
+		closure_cache = {};
+	}
+
+	// Items held by the closure cache.
+	size_t cached_items() const {
+		size_t n = 0;
+		for (auto& c : closure_cache) n += c.size();
+		return n;
+	}
+
+	// Returns the id of the state with this (sorted) kernel, registering a
+	// new state if it has not been seen before.
+	int add_state(vector<Item> kernel) {
+		auto it = state_ids.find(kernel);
+		if (it != state_ids.end()) return it->second;
+		int id = kernels.size();
+		if (mode == Canonical) item_set.push_back(closure(kernel));
+		kernels.push_back(kernel);
+		transitions.push_back(vector<int>(symbols.size(), -1));
+		state_ids.emplace(move(kernel), id);
+		return id;
+	}
+
+	// Expands states in the order they are discovered until no new kernel
+	// shows up. Items are closed with close_lr0 for the LR(0) automaton.
+	void generate_states(bool close_lr0) {
+		vector<SymbolId> grammar_symbols;
+		for (SymbolId x = symbols.num_terminals; x < symbols.size(); x++)
+			if (x != productions[0].lhs) grammar_symbols.push_back(x);
+		for (SymbolId x = 0; x < symbols.num_terminals; x++)
+			if (x != eoi) grammar_symbols.push_back(x);
+
+		add_state({Item(0, eoi)});
+		// the state list grows while we walk it, every state is expanded once
+		vector<vector<Item>> next(symbols.size());
+		for (int i = 0; i < kernels.size(); i++) {
+			for (auto& k : next) k.clear();
+			// kernel-only closures are dropped once the state is expanded,
+			// the cache is for the table builders
+			vector<Item> closed;
+			if (close_lr0) closed = lr0_closure(kernels[i]);
+			else if (mode == KernelOnly) closed = kernel_closure(kernels[i]);
+			for (auto& item : mode == Canonical ? item_set[i] : closed) {
+				auto& rhs = productions[item.production].rhs;
+				if (item.dot_idx < rhs.size()) next[rhs[item.dot_idx]].push_back(Item(item.production, item.dot_idx + 1, item.lookahead));
+			}
+			for (auto symb : grammar_symbols) {
+				if (next[symb].empty()) continue;
+				sort(next[symb].begin(), next[symb].end());
+				transitions[i][symb] = add_state(next[symb]);
+			}
+		}
+	}
 
-    bool is_in_item_set(vector<Item> set) {
-        for (auto soi : item_set) {
-            if (set == soi) return true;
-        }
-        return false;
-    }
+	void generate_lr1_items() {
+		generate_states(false);
+	}
 
-    void generate_lr1_items() {
-        item_set.push_back(closure({Item(productions[0])}));
-        vector<string> grammar_symbols = {"E", "T", "F", "(", "id", ")", "+", "*",};
-        bool done = false;
-        while (!done) {
-            done = true;
-            for (int i = 0; i < item_set.size(); i++) {
-                for (auto symb : grammar_symbols) {
-                    auto g = Goto(item_set[i], symb);
-                    if (g.size() != 0 && !is_in_item_set(g)) {
-                        goto_history.push_back({i, symb});
-                        item_set.push_back(g);
-                        done = false;
-                    } else if (g.size() != 0) {
-						int k;
-						for (k = 0; k < item_set.size() && item_set[k] != g; k++);
-						existing_goto_history.push_back({{i, symb}, k});
-					}
-                }
-            }
-        }
-        clean_item_set();
-    }
+	// LR(0) closure. LR(0) items carry eoi as a placeholder lookahead.
+	vector<Item> lr0_closure(const vector<Item>& kernel) {
+		vector<Item> I = kernel;
+		vector<bool> expanded(symbols.size(), false);
+		for (int i = 0; i < I.size(); i++) {
+			Item item = I[i];
+			auto& rhs = productions[item.production].rhs;
+			if (item.dot_idx >= rhs.size() || symbols.is_terminal(rhs[item.dot_idx]) || expanded[rhs[item.dot_idx]]) continue;
+			expanded[rhs[item.dot_idx]] = true;
+			for (int p : lhs_productions[rhs[item.dot_idx]]) I.push_back(Item(p, eoi));
+		}
+		return I;
+	}
 
-    void clean_item_set() {
-        for (auto& x : item_set) {
-			vector<Item> cleaned;
-			for (auto i : x) {
-				bool exists = false;
-				for (auto k : cleaned) {
-					if (k.lhs == i.lhs && k.rhs == i.rhs && k.dot_idx == i.dot_idx) {
-						exists = true;
-						break;
-					}
-				}
-				if (exists) continue;
-				Item ni(i.lhs, i.rhs, i.dot_idx, "");
-				set<string> lookaheads;
-				for (auto tmp : x) {
-					if (tmp.lhs == ni.lhs && tmp.rhs == ni.rhs && tmp.dot_idx == ni.dot_idx) {
-						lookaheads.insert(tmp.lookahead);
-					}
+	// DeRemer & Pennello's digraph: F(x) = F'(x) U { F(y) | x R y }, solved
+	// in one pass that collapses strongly connected components. F holds F'
+	// on entry.
+	static void digraph(const vector<vector<int>>& R, vector<TerminalSet>& F) {
+		vector<int> N(R.size(), 0);
+		vector<int> stk;
+		function<void(int)> traverse = [&](int x) {
+			stk.push_back(x);
+			int d = stk.size();
+			N[x] = d;
+			for (int y : R[x]) {
+				if (N[y] == 0) traverse(y);
+				N[x] = min(N[x], N[y]);
+				F[x].or_with(F[y]);
+			}
+			if (N[x] == d) {
+				while (true) {
+					int top = stk.back();
+					stk.pop_back();
+					N[top] = INT_MAX;
+					if (top == x) break;
+					F[top] = F[x];
 				}
-				ni.lookahead = *(lookaheads.begin());
-				for (auto i : lookaheads)
-					if (i != *lookaheads.begin()) ni.lookahead = ni.lookahead + "/" + i;
-				cleaned.push_back(ni);
 			}
+		};
+		for (int x = 0; x < R.size(); x++)
+			if (N[x] == 0) traverse(x);
+	}
 
-			x = cleaned;
-		}
-    }
+	// LALR(1) without the canonical collection: build the LR(0) automaton,
+	// compute Follow over its nonterminal transitions with the reads and
+	// includes relations, then hand every kernel item the Follow sets of
+	// the transitions it looks back to. The states end up with ordinary
+	// LR(1) kernels, so everything downstream treats them like KernelOnly.
+	void generate_lalr1_items() {
+		generate_states(true);
 
-	map<pair<int, Token>, Action*> action_map() {
-		map<pair<int, Token>, Action*> action_map;
+		// number the nonterminal transitions (p, A)
+		int T = symbols.num_terminals;
+		vector<pair<int, SymbolId>> nt_trans;
+		vector<int> trans_idx(num_states() * symbols.num_non_terminals(), -1);
+		for (int p = 0; p < num_states(); p++)
+			for (SymbolId A = T; A < symbols.size(); A++)
+				if (transitions[p][A] != -1) {
+					trans_idx[p * symbols.num_non_terminals() + A - T] = nt_trans.size();
+					nt_trans.push_back({p, A});
+				}
 
-		// init action map
-		for (auto token : {Token::PLUS, Token::MULT, Token::BRACKET_OPEN, Token::BRACKET_CLOSE, Token::ID, Token::EOI}) {
-			for (int i = 0; i < item_set.size(); i++)
-				action_map[{i, token}] = nullptr;
+		// DR(p, A): terminals shifted right after the transition, plus eoi
+		// after the start symbol. (p, A) reads (r, C) if C is nullable.
+		vector<TerminalSet> F(nt_trans.size(), TerminalSet(T));
+		vector<vector<int>> reads(nt_trans.size());
+		for (int x = 0; x < nt_trans.size(); x++) {
+			int r = transitions[nt_trans[x].first][nt_trans[x].second];
+			for (SymbolId t = 0; t < T; t++)
+				if (transitions[r][t] != -1) F[x].insert(t);
+			for (auto& item : kernels[r])
+				if (item.production == 0 && item.dot_idx == 1) F[x].insert(eoi);
+			for (SymbolId C = T; C < symbols.size(); C++)
+				if (transitions[r][C] != -1 && nullable[C]) reads[x].push_back(trans_idx[r * symbols.num_non_terminals() + C - T]);
 		}
+		digraph(reads, F);
 
-		// add shift actions
-		for (int i = 0; i < existing_goto_history.size(); i++) {
-			if (non_terminals.find(existing_goto_history[i].first.second) == non_terminals.end()) {
-				if (action_map[{existing_goto_history[i].first.first, token_map[existing_goto_history[i].first.second]}] == nullptr)
-					action_map[{existing_goto_history[i].first.first, token_map[existing_goto_history[i].first.second]}] = SHFT_ACTN(existing_goto_history[i].second); 
+		// (p, A) includes (p', B) if B -> bAc with c nullable and p' -b-> p
+		vector<vector<int>> includes(nt_trans.size());
+		for (int x = 0; x < nt_trans.size(); x++) {
+			for (int prod : lhs_productions[nt_trans[x].second]) {
+				auto& rhs = productions[prod].rhs;
+				int s = nt_trans[x].first;
+				for (int k = 0; k < rhs.size(); k++) {
+					if (!symbols.is_terminal(rhs[k]) && suffix_nullable[prod][k + 1])
+						includes[trans_idx[s * symbols.num_non_terminals() + rhs[k] - T]].push_back(x);
+					s = transitions[s][rhs[k]];
+				}
 			}
 		}
+		digraph(includes, F);
 
-		// add reduce actions
-		map<string, int> reduction_map = {
-			{"E", 0}, {"E+T", 1}, {"T", 2}, {"T*F", 3}, {"F", 4}, {"(E)", 5}, {"id", 6}
-		};
-		for (int i = 2; i < item_set.size(); i++) {
-			for (auto item : item_set[i]) {
-				if (item.dot_idx == item.rhs.size()) {
-					for (char c : item.lookahead) if (c != '/') {
-						string lah(1, c);
-						action_map[{i, token_map[lah]}] = REDC_ACTN(reduction_map[item.rhs]);
-					}
-				}
+		// Walk every production from every transition on its lhs: each kernel
+		// item on the way looks back to that transition.
+		vector<vector<TerminalSet>> lookaheads(num_states());
+		for (int s = 0; s < num_states(); s++)
+			lookaheads[s].assign(kernels[s].size(), TerminalSet(T));
+		auto add_lookaheads = [&](int start, int prod, const TerminalSet& la) {
+			int s = start;
+			for (int k = 0; k < productions[prod].rhs.size(); k++) {
+				s = transitions[s][productions[prod].rhs[k]];
+				int i = lower_bound(kernels[s].begin(), kernels[s].end(), Item(prod, k + 1, eoi)) - kernels[s].begin();
+				lookaheads[s][i].or_with(la);
 			}
+		};
+		TerminalSet end_of_input(T);
+		end_of_input.insert(eoi);
+		lookaheads[0][0] = end_of_input;
+		add_lookaheads(0, 0, end_of_input);
+		for (int x = 0; x < nt_trans.size(); x++)
+			for (int prod : lhs_productions[nt_trans[x].second])
+				add_lookaheads(nt_trans[x].first, prod, F[x]);
+
+		state_ids.clear();
+		for (int s = 0; s < num_states(); s++) {
+			vector<Item> kernel;
+			for (int i = 0; i < kernels[s].size(); i++)
+				lookaheads[s][i].for_each([&](SymbolId la) {
+					kernel.push_back(Item(kernels[s][i].production, kernels[s][i].dot_idx, la));
+				});
+			sort(kernel.begin(), kernel.end());
+			kernels[s] = kernel;
+			state_ids.emplace(kernel, s);
 		}
+	}
 
-		// add accept action
-		action_map[{1, Token::EOI}] = ACC_ACTN;
+	map<pair<int, SymbolId>, Action> action_map() {
+		map<pair<int, SymbolId>, Action> action_map;
 
-		// add err actions
-		for (auto token : {Token::PLUS, Token::MULT, Token::BRACKET_OPEN, Token::BRACKET_CLOSE, Token::ID, Token::EOI}) {
-			for (int i = 0; i < item_set.size(); i++) if (action_map[{i, token}] == nullptr) {
+		// init action map
+		for (SymbolId token = 0; token < symbols.num_terminals; token++) {
+			for (int i = 0; i < num_states(); i++)
 				action_map[{i, token}] = ERR_ACTN;
+		}
+
+		// add shift actions
+		for (int i = 0; i < num_states(); i++) {
+			for (SymbolId token = 0; token < symbols.num_terminals; token++)
+				if (transitions[i][token] != -1)
+					action_map[{i, token}] = SHFT_ACTN(transitions[i][token]);
+		}
+
+		// add reduce and accept actions
+		for (int i = 0; i < num_states(); i++) {
+			for (auto& item : state_items(i)) {
+				if (item.dot_idx == productions[item.production].rhs.size()) {
+					if (item.production == 0)
+						action_map[{i, item.lookahead}] = ACC_ACTN;
+					else
+						action_map[{i, item.lookahead}] = REDC_ACTN(item.production);
+				}
 			}
 		}
 
-		
 		return action_map;
 	}
 
-	map<pair<int, string>, int> goto_map() {
-		map<pair<int, string>, int> goto_map;
+	map<pair<int, SymbolId>, int> goto_map() {
+		map<pair<int, SymbolId>, int> goto_map;
 
 		// initialize goto_map
-		for (int i = 0; i < productions.size(); i++)
-			for (int j = 0; j <= item_set.size(); j++)
-				goto_map[{j, str_productions[i][0]}] = -1;
-		
-		for (int i = 0; i < existing_goto_history.size(); i++) {
-			if (non_terminals.find(existing_goto_history[i].first.second) != non_terminals.end()) {
-				if (goto_map[{existing_goto_history[i].first.first, existing_goto_history[i].first.second}] == -1)
-					goto_map[{existing_goto_history[i].first.first, existing_goto_history[i].first.second}] = existing_goto_history[i].second; 
-			}
+		for (SymbolId nt = symbols.num_terminals; nt < symbols.size(); nt++)
+			for (int j = 0; j < num_states(); j++)
+				goto_map[{j, nt}] = -1;
+
+		for (int i = 0; i < num_states(); i++) {
+			for (SymbolId nt = symbols.num_terminals; nt < symbols.size(); nt++)
+				if (transitions[i][nt] != -1)
+					goto_map[{i, nt}] = transitions[i][nt];
 		}
 
 		return goto_map;
 	}
 
+	set<pair<int, int>> core(const vector<Item>& I) const {
+		set<pair<int, int>> c;
+		for (auto& i : I) c.insert({i.production, i.dot_idx});
+		return c;
+	}
+
 	bool has_same_core(vector<Item>& i1, vector<Item>& i2) {
-		if (i1.size() != i2.size()) return false;
-		for (auto p : i1) {
-			bool exists = false;
-			for (auto op : i2) if(p.lhs == op.lhs && p.rhs == op.rhs && p.dot_idx == op.dot_idx) {
-				exists = true;
-				break;
-			}
-			if (exists == false) return false;
-		}
-		return true;
+		return core(i1) == core(i2);
 	}
 
 	vector<pair<int, vector<int>>> lalr_grouping() {
 		int idx = 0;
 		set<int> used_states;
 		vector<pair<int, vector<int>>> ans;
-		for (int i = 0; i < item_set.size(); i++) {
+		for (int i = 0; i < num_states(); i++) {
 			if (used_states.find(i) != used_states.end()) continue;
 			vector<int> grouping {i};
 			used_states.insert(i);
-			for (int j = i + 1; j < item_set.size(); j++) {
+			for (int j = i + 1; j < num_states(); j++) {
 				if (used_states.find(j) != used_states.end()) continue;
-				if (has_same_core(item_set[i], item_set[j])) {
+				if (has_same_core(kernels[i], kernels[j])) {
 					grouping.push_back(j);
 					used_states.insert(j);
 				}
@@ -680,19 +2969,125 @@ struct Grammar {
 		return ans;
 	}
 
-	map<pair<int, Token>, Action*> lalr_action_map(map<pair<int, Token>, Action*>& clr_action_map) {
-		auto grouping = lalr_grouping();
+	// Every action the items of each state call for, before conflicts are
+	// resolved: -1 for a shift, p for a reduce by p (accept is a reduce by 0).
+	vector<vector<vector<int>>> state_actions() {
+		vector<vector<vector<int>>> acts(num_states(), vector<vector<int>>(symbols.num_terminals));
+		for (int i = 0; i < num_states(); i++) {
+			for (SymbolId t = 0; t < symbols.num_terminals; t++)
+				if (transitions[i][t] != -1) acts[i][t].push_back(-1);
+			for (auto& item : state_items(i)) {
+				if (item.dot_idx != productions[item.production].rhs.size()) continue;
+				auto& a = acts[i][item.lookahead];
+				if (find(a.begin(), a.end(), item.production) == a.end()) a.push_back(item.production);
+			}
+		}
+		return acts;
+	}
+
+	// Table cells with more than one action once each group is merged.
+	int count_conflicts(const vector<pair<int, vector<int>>>& grouping) {
+		auto acts = state_actions();
+		int conflicts = 0;
+		for (auto& g : grouping) {
+			for (SymbolId t = 0; t < symbols.num_terminals; t++) {
+				set<int> merged;
+				for (int s : g.second) merged.insert(acts[s][t].begin(), acts[s][t].end());
+				if (merged.size() > 1) conflicts++;
+			}
+		}
+		return conflicts;
+	}
+
+	// Groups states like lalr_grouping(), except that states sharing a core
+	// stay apart where merging them would create a conflict that none of
+	// them has on its own (the idea behind Pager's PGM and IELR). Groups are
+	// then split until all members of a group move to the same groups, so
+	// the merged automaton stays deterministic, and both steps repeat until
+	// neither changes anything.
+	vector<pair<int, vector<int>>> minimal_lr_grouping() {
+		auto acts = state_actions();
+		vector<int> group(num_states());
+		int num_groups = 0;
+		for (auto& g : lalr_grouping()) {
+			for (int s : g.second) group[s] = g.first;
+			num_groups++;
+		}
+
+		bool changed = true;
+		while (changed) {
+			changed = false;
+
+			// split every group into parts that merge without new conflicts
+			vector<vector<int>> members(num_groups);
+			for (int s = 0; s < num_states(); s++) members[group[s]].push_back(s);
+			for (auto& m : members) {
+				vector<vector<set<int>>> merged;
+				vector<vector<int>> largest;
+				vector<int> part_group;
+				for (int s : m) {
+					int k = 0;
+					for (; k < merged.size(); k++) {
+						bool compatible = true;
+						for (SymbolId t = 0; t < symbols.num_terminals && compatible; t++) {
+							set<int> u = merged[k][t];
+							u.insert(acts[s][t].begin(), acts[s][t].end());
+							compatible = u.size() <= max<int>(largest[k][t], acts[s][t].size());
+						}
+						if (compatible) break;
+					}
+					if (k == merged.size()) {
+						merged.push_back(vector<set<int>>(symbols.num_terminals));
+						largest.push_back(vector<int>(symbols.num_terminals, 0));
+						part_group.push_back(k == 0 ? group[s] : num_groups++);
+						if (k > 0) changed = true;
+					}
+					for (SymbolId t = 0; t < symbols.num_terminals; t++) {
+						merged[k][t].insert(acts[s][t].begin(), acts[s][t].end());
+						largest[k][t] = max<int>(largest[k][t], acts[s][t].size());
+					}
+					group[s] = part_group[k];
+				}
+			}
+
+			// split groups whose members go to different groups
+			map<vector<int>, int> signatures;
+			vector<int> refined(num_states());
+			for (int s = 0; s < num_states(); s++) {
+				vector<int> sig {group[s]};
+				for (int target : transitions[s]) sig.push_back(target == -1 ? -1 : group[target]);
+				refined[s] = signatures.emplace(sig, signatures.size()).first->second;
+			}
+			if (signatures.size() != num_groups) changed = true;
+			group = refined;
+			num_groups = signatures.size();
+		}
+
+		// number the groups in the order of their first state, as lalr_grouping() does
+		vector<int> renumber(num_groups, -1);
+		vector<pair<int, vector<int>>> ans;
+		for (int s = 0; s < num_states(); s++) {
+			if (renumber[group[s]] == -1) {
+				renumber[group[s]] = ans.size();
+				ans.push_back({static_cast<int>(ans.size()), {}});
+			}
+			ans[renumber[group[s]]].second.push_back(s);
+		}
+		return ans;
+	}
+
+	map<pair<int, SymbolId>, Action> merged_action_map(map<pair<int, SymbolId>, Action>& clr_action_map, const vector<pair<int, vector<int>>>& grouping) {
 		map<int, int> old_to_new;
 		for (auto g : grouping) for (auto i : g.second) old_to_new[i] = g.first;
-		map<pair<int, Token>, Action*> new_action_map;
-		for (auto token : {Token::PLUS, Token::MULT, Token::BRACKET_OPEN, Token::BRACKET_CLOSE, Token::ID, Token::EOI}) {
-			for(int i = 0; i < item_set.size(); i++) {
-				if (new_action_map.find({old_to_new[i], token}) == new_action_map.end() || new_action_map[{old_to_new[i], token}]->type == Action::Error) {
-					if (clr_action_map[{i, token}]->type == Action::Shift) {
-						ShiftAction* a = reinterpret_cast<ShiftAction*>(clr_action_map[{i, token}]);
-						new_action_map[{old_to_new[i], token}] = SHFT_ACTN(old_to_new[(a->shift_state)]);
+		map<pair<int, SymbolId>, Action> new_action_map;
+		for (SymbolId token = 0; token < symbols.num_terminals; token++) {
+			for(int i = 0; i < num_states(); i++) {
+				if (new_action_map.find({old_to_new[i], token}) == new_action_map.end() || new_action_map[{old_to_new[i], token}].type() == Action::Error) {
+					Action a = clr_action_map[{i, token}];
+					if (a.type() == Action::Shift) {
+						new_action_map[{old_to_new[i], token}] = SHFT_ACTN(old_to_new[a.value()]);
 					} else {
-						new_action_map[{old_to_new[i], token}] = clr_action_map[{i, token}];
+						new_action_map[{old_to_new[i], token}] = a;
 					}
 				}
 			}
@@ -701,22 +3096,21 @@ struct Grammar {
 		return new_action_map;
 	}
 
-	map<pair<int, string>, int> lalr_goto_map(map<pair<int, string>, int>& clr_goto_map) {
-		auto grouping = lalr_grouping();
+	map<pair<int, SymbolId>, int> merged_goto_map(map<pair<int, SymbolId>, int>& clr_goto_map, const vector<pair<int, vector<int>>>& grouping) {
 		map<int, int> old_to_new;
 		for (auto g : grouping) for (auto i : g.second) old_to_new[i] = g.first;
-		map<pair<int, string>, int> new_goto_map;
+		map<pair<int, SymbolId>, int> new_goto_map;
 
-		for (int i = 0; i < productions.size(); i++)
-			for (int j = 0; j <= grouping.size(); j++)
-				new_goto_map[{j, str_productions[i][0]}] = -1;
+		for (SymbolId nt = symbols.num_terminals; nt < symbols.size(); nt++)
+			for (int j = 0; j < grouping.size(); j++)
+				new_goto_map[{j, nt}] = -1;
 
 		for (auto kp : clr_goto_map) {
 			int os = kp.first.first;
 			if (old_to_new.find(os) == old_to_new.end() || old_to_new.find(kp.second) == old_to_new.end()) continue;
 			int ns = old_to_new[os];
 			int ngs = old_to_new[kp.second];
-			string nt = kp.first.second;
+			SymbolId nt = kp.first.second;
 			if (new_goto_map.find({ns, nt}) != new_goto_map.end()) {
 				new_goto_map[{ns, nt}] = ngs;
 			}
@@ -725,33 +3119,83 @@ struct Grammar {
 		return new_goto_map;
 	}
 
-	void print_items() const {
-		int i = 0;
-		for (auto items : item_set) {
+	map<pair<int, SymbolId>, Action> lalr_action_map(map<pair<int, SymbolId>, Action>& clr_action_map) {
+		return merged_action_map(clr_action_map, lalr_grouping());
+	}
+
+	map<pair<int, SymbolId>, int> lalr_goto_map(map<pair<int, SymbolId>, int>& clr_goto_map) {
+		return merged_goto_map(clr_goto_map, lalr_grouping());
+	}
+
+	ParseTable parse_table(map<pair<int, SymbolId>, Action>& action_map, map<pair<int, SymbolId>, int>& goto_map) {
+		ParseTable table;
+		for (auto& kp : action_map)
+			table.num_states = max(table.num_states, kp.first.first + 1);
+		table.num_terminals = symbols.num_terminals;
+		table.num_non_terminals = symbols.num_non_terminals();
+
+		table.action.assign(table.num_states * table.num_terminals, ERR_ACTN);
+		for (auto& kp : action_map)
+			table.action[kp.first.first * table.num_terminals + kp.first.second] = kp.second;
+
+		table.goto_table.assign(table.num_states * table.num_non_terminals, -1);
+		for (auto& kp : goto_map) {
+			if (kp.first.first >= table.num_states) continue;
+			table.goto_table[kp.first.first * table.num_non_terminals + kp.first.second - table.num_terminals] = kp.second;
+		}
+
+		for (auto& p : productions) {
+			table.productions.push_back({p.lhs - table.num_terminals, static_cast<int>(p.rhs.size())});
+			table.production_rhs.push_back(p.rhs);
+		}
+		table.symbol_names = symbols.names;
+		return table;
+	}
+
+	string item_str(int production, int dot_idx, const string& lookahead) const {
+		const Production& p = productions[production];
+		vector<string> rhs;
+		for (SymbolId x : p.rhs) rhs.push_back(symbols.name(x));
+		return "[" + symbols.name(p.lhs) + " -> " + rhs_str(rhs, dot_idx) + " , " + lookahead + "]";
+	}
+
+	void print_items() {
+		for (int i = 0; i < num_states(); i++) {
+			auto& items = state_items(i);
 			cout << "State I" << i << endl;
-			for (auto item : items) {
-				cout << "[" << item << "]" << endl;
+			// items that only differ in lookahead are shown as one
+			vector<pair<int, int>> cores;
+			map<pair<int, int>, set<string>> lookaheads;
+			for (auto& item : items) {
+				pair<int, int> c {item.production, item.dot_idx};
+				if (lookaheads.find(c) == lookaheads.end()) cores.push_back(c);
+				lookaheads[c].insert(symbols.name(item.lookahead));
+			}
+			for (auto& c : cores) {
+				string la;
+				for (auto& l : lookaheads[c]) la += (la.empty() ? "" : "/") + l;
+				cout << "[" << item_str(c.first, c.second, la) << "]" << endl;
 			}
 			cout << "-------" << endl << endl;
-			i++;
 		}
 	}
 
-	void print_parse_table(map<pair<int, Token>, Action*> action_map, map<pair<int, string>, int> goto_map) {
-		cout << "state\t+\t*\t(\t)\tid\t$\tE\tT\tF\n";
-		for (int i = 0; i < item_set.size(); i++) {
-			if (action_map.find({i, Token::EOI}) == action_map.end()) return;
+	void print_parse_table(map<pair<int, SymbolId>, Action> action_map, map<pair<int, SymbolId>, int> goto_map) {
+		cout << "state";
+		for (SymbolId x = 0; x < symbols.size(); x++)
+			if (x != productions[0].lhs) cout << "\t" << symbols.name(x);
+		cout << "\n";
+		for (int i = 0; i < num_states(); i++) {
+			if (action_map.find({i, eoi}) == action_map.end()) return;
 			cout << i << "\t";
-			for (auto token : {Token::PLUS, Token::MULT, Token::BRACKET_OPEN, Token::BRACKET_CLOSE, Token::ID, Token::EOI}) {
-				switch(action_map[{i, token}]->type) {
+			for (SymbolId token = 0; token < symbols.num_terminals; token++) {
+				switch(action_map[{i, token}].type()) {
 					case Action::Shift: {
-						ShiftAction* a = reinterpret_cast<ShiftAction*>(action_map[{i, token}]);
-						cout << "s" << a->shift_state << "\t";
+						cout << "s" << action_map[{i, token}].value() << "\t";
 						break;
 					}
 					case Action::Reduce: {
-						ReduceAction* a = reinterpret_cast<ReduceAction*>(action_map[{i, token}]);
-						cout << "r" << a->production_id << "\t";
+						cout << "r" << action_map[{i, token}].value() << "\t";
 						break;
 					}
 					case Action::Accept: {
@@ -765,7 +3209,8 @@ struct Grammar {
 				}
 			}
 
-			for (auto nt : {"E", "T", "F"}) {
+			for (SymbolId nt = symbols.num_terminals; nt < symbols.size(); nt++) {
+				if (nt == productions[0].lhs) continue;
 				if (goto_map[{i, nt}] != -1) {
 					cout << goto_map[{i, nt}] << "\t";
 				} else {
@@ -776,59 +3221,992 @@ struct Grammar {
 		}
 	}
 
-	map<string, Token> token_map = {
-		{"+", Token::PLUS}, {"*", Token::MULT}, {"id", Token::ID}, {"(", Token::BRACKET_OPEN}, {")", Token::BRACKET_CLOSE}, {"$", Token::EOI}
+	SymbolTable symbols;
+	SymbolId eoi;
+	ItemSetMode mode;
+	vector<vector<Item>> kernels;
+	vector<vector<Item>> item_set;
+	vector<vector<Item>> closure_cache;
+	vector<vector<Expansion>> expansion_cache;
+	vector<vector<int>> transitions;
+	unordered_map<vector<Item>, int, KernelHash> state_ids;
+	vector<Production> productions;
+	vector<vector<int>> lhs_productions;
+	vector<TerminalSet> first_sets;
+	vector<bool> nullable;
+	vector<vector<TerminalSet>> suffix_first;
+	vector<vector<bool>> suffix_nullable;
+};
+
+// Reads a grammar file in a yacc-like format:
+//
+//   %token id num          terminals written as names
+//   %token ident /[a-z]+/  a terminal lexed by a regex (see TokenDfa)
+//   %start expr            optional, the first rule's left hand side otherwise
+//   %%
+//   expr : expr '+' term
+//        | term
+//        ;
+//   term : id | num | '(' expr ')' | %empty ;
+//   %%
+//
+// Quoted literals are terminals named by their text, an empty alternative
+// (or %empty) derives epsilon, comments are /* */ or //, and anything after
+// a second %% is ignored. Every name has to be declared with %token or have
+// rules of its own. The rules come back with the augmented start rule
+// prepended, ready for Grammar, and the patterns given after %token names
+// are kept for the lexer.
+class GrammarReader {
+public:
+	GrammarReader(const string& name, const string& text)
+		:name(name), text(text) {
+	}
+
+	vector<rule> read() {
+		tokenize();
+
+		// declarations
+		set<string> tokens;
+		string start;
+		while (!at("%%")) {
+			if (at_end())
+				fail("expected %% before the rules");
+			if (at("%token")) {
+				pos++;
+				while (!at_end() && toks[pos].kind == Name) {
+					string token = toks[pos++].text;
+					tokens.insert(token);
+					if (!at_end() && toks[pos].kind == Regex)
+						patterns[token] = toks[pos++].text;
+				}
+			} else if (at("%start")) {
+				pos++;
+				if (at_end() || toks[pos].kind != Name)
+					fail("expected a name after %start");
+				start = toks[pos++].text;
+			} else {
+				fail("unexpected '" + toks[pos].text + "' in the declarations, missing %%?");
+			}
+		}
+		pos++;
+
+		// rules
+		vector<rule> rules;
+		set<string> literals;
+		while (!at_end() && !at("%%")) {
+			if (toks[pos].kind != Name)
+				fail("expected a rule name, got '" + toks[pos].text + "'");
+			string lhs = toks[pos++].text;
+			if (!at(":"))
+				fail("expected ':' after " + lhs);
+			pos++;
+			vector<string> rhs;
+			while (true) {
+				if (at_end() || at("%%") || at(";") || at("|") || starts_rule()) {
+					rules.push_back({lhs, rhs});
+					rhs.clear();
+					if (at("|")) {
+						pos++;
+						continue;
+					}
+					if (at(";")) pos++;
+					break;
+				}
+				const Tok& t = toks[pos++];
+				if (t.kind == Literal) {
+					rhs.push_back(t.text);
+					literals.insert(t.text);
+				} else if (t.kind == Name) {
+					rhs.push_back(t.text);
+				} else if (t.text != "%empty") {
+					fail("unexpected '" + t.text + "' in a rule", t.line);
+				}
+			}
+		}
+		if (rules.empty())
+			fail("no rules");
+
+		set<string> lhs_names;
+		for (auto& r : rules)
+			lhs_names.insert(r.first);
+		for (auto& t : tokens)
+			if (lhs_names.count(t))
+				fail("token " + t + " has rules");
+		for (auto& r : rules)
+			for (auto& x : r.second)
+				if (x == "$" || (!lhs_names.count(x) && !tokens.count(x) && !literals.count(x)))
+					fail(x == "$" ? "$ is reserved for the end of input" : "undeclared symbol " + x + " in the rules of " + r.first);
+		if (start.empty())
+			start = rules[0].first;
+		if (!lhs_names.count(start))
+			fail("start symbol " + start + " has no rules");
+
+		string augmented = start + "'";
+		while (lhs_names.count(augmented) || tokens.count(augmented) || literals.count(augmented))
+			augmented += "'";
+		rules.insert(rules.begin(), {augmented, {start}});
+		return rules;
+	}
+
+	// Pattern of every %token declared with one, filled by read().
+	const map<string, string>& token_patterns() const {
+		return patterns;
+	}
+
+private:
+	enum TokKind { Name, Literal, Regex, Punct, Directive };
+	struct Tok {
+		TokKind kind;
+		string text;
+		int line;
 	};
-    vector<pair<int, string>> goto_history;
-	vector<pair<pair<int, string>, int>> existing_goto_history;
-    set<string> non_terminals;
-    vector<vector<Item>> item_set;
-    vector<production> productions;
+
+	void tokenize() {
+		int line = 1;
+		for (size_t i = 0; i < text.size();) {
+			char c = text[i];
+			if (c == '\n') {
+				line++;
+				i++;
+			} else if (isspace(static_cast<unsigned char>(c))) {
+				i++;
+			} else if (text.compare(i, 2, "//") == 0) {
+				while (i < text.size() && text[i] != '\n') i++;
+			} else if (text.compare(i, 2, "/*") == 0) {
+				size_t end = text.find("*/", i + 2);
+				if (end == string::npos)
+					fail("unterminated comment", line);
+				line += count(text.begin() + i, text.begin() + end, '\n');
+				i = end + 2;
+			} else if (c == '/') {
+				// kept as written, escapes are left to TokenDfa
+				size_t j = i + 1;
+				for (; j < text.size() && text[j] != '/' && text[j] != '\n'; j++)
+					if (text[j] == '\\' && j + 1 < text.size() && text[j + 1] != '\n') j++;
+				if (j >= text.size() || text[j] != '/')
+					fail("unterminated pattern", line);
+				toks.push_back({Regex, text.substr(i + 1, j - i - 1), line});
+				i = j + 1;
+			} else if (c == '\'' || c == '"') {
+				string lit;
+				size_t j = i + 1;
+				for (; j < text.size() && text[j] != c && text[j] != '\n'; j++) {
+					if (text[j] == '\\' && j + 1 < text.size()) j++;
+					lit += text[j];
+				}
+				if (j >= text.size() || text[j] != c)
+					fail("unterminated literal", line);
+				if (lit.empty())
+					fail("empty literal", line);
+				toks.push_back({Literal, lit, line});
+				i = j + 1;
+			} else if (c == '%') {
+				size_t j = i + 1;
+				if (j < text.size() && text[j] == '%') {
+					j++;
+				} else {
+					while (j < text.size() && isalpha(static_cast<unsigned char>(text[j]))) j++;
+				}
+				toks.push_back({Directive, text.substr(i, j - i), line});
+				i = j;
+			} else if (c == ':' || c == '|' || c == ';') {
+				toks.push_back({Punct, string(1, c), line});
+				i++;
+			} else if (isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.') {
+				size_t j = i;
+				while (j < text.size() && (isalnum(static_cast<unsigned char>(text[j])) || text[j] == '_' || text[j] == '.')) j++;
+				toks.push_back({Name, text.substr(i, j - i), line});
+				i = j;
+			} else {
+				fail(string("unexpected character '") + c + "'", line);
+			}
+		}
+	}
+
+	bool at_end() const {
+		return pos >= toks.size();
+	}
+
+	bool at(const string& s) const {
+		return !at_end() && (toks[pos].kind == Punct || toks[pos].kind == Directive) && toks[pos].text == s;
+	}
+
+	// A name followed by ':' starts the next rule even without a ';'.
+	bool starts_rule() const {
+		return toks[pos].kind == Name && pos + 1 < toks.size() && toks[pos + 1].kind == Punct && toks[pos + 1].text == ":";
+	}
+
+	void fail(const string& msg, int line = -1) const {
+		if (line == -1)
+			line = at_end() ? (toks.empty() ? 1 : toks.back().line) : toks[pos].line;
+		throw runtime_error(name + ":" + to_string(line) + ": " + msg);
+	}
+
+	string name;
+	string text;
+	vector<Tok> toks;
+	size_t pos = 0;
+	map<string, string> patterns;
+};
+
+vector<rule> load_grammar(const string& path, map<string, string>& patterns) {
+	ifstream in(path);
+	if (!in)
+		throw runtime_error("cannot open " + path);
+	stringstream ss;
+	ss << in.rdbuf();
+	GrammarReader reader(path, ss.str());
+	vector<rule> rules = reader.read();
+	patterns = reader.token_patterns();
+	return rules;
+}
+
+// Expression grammar with `levels` binary operator precedence levels:
+// E0 -> E0 o0 E1 | E1, ..., En -> ( E0 ) | id
+vector<production> expression_grammar(int levels) {
+	vector<production> p = {{"S", "E0"}};
+	for (int i = 0; i < levels; i++) {
+		string e = "E" + to_string(i), next = "E" + to_string(i + 1);
+		p.push_back({e, e + " o" + to_string(i) + " " + next});
+		p.push_back({e, next});
+	}
+	string last = "E" + to_string(levels);
+	p.push_back({last, "( E0 )"});
+	p.push_back({last, "id"});
+	return p;
+}
+
+void bench_closure() {
+	typedef chrono::steady_clock clock;
+	cout << left << setw(8) << "levels" << setw(13) << "productions" << setw(8) << "states" << setw(16) << "item sets (ms)" << setw(14) << "items kept" << setw(18) << "kernel-only (ms)" << setw(14) << "items kept" << setw(10) << "cached" << setw(14) << "us / closure" << setw(18) << "direct LALR (ms)" << setw(14) << "LALR states" << endl;
+	for (int levels : {1, 2, 4, 8, 16, 32, 64}) {
+		auto start = clock::now();
+		Grammar grammar(expression_grammar(levels));
+		double build_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+		start = clock::now();
+		Grammar kernel_grammar(expression_grammar(levels), Grammar::KernelOnly);
+		double kernel_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+		start = clock::now();
+		Grammar lalr_grammar(expression_grammar(levels), Grammar::DirectLALR);
+		double lalr_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+		size_t items = 0, kernel_items = 0;
+		for (auto& i : grammar.item_set) items += i.size();
+		for (auto& k : kernel_grammar.kernels) kernel_items += k.size();
+		// closures the kernel-only build left behind count as kept
+		size_t cached = kernel_grammar.cached_items();
+		kernel_items += cached;
+
+		// re-close every state from its kernel
+		start = clock::now();
+		for (auto& kernel : grammar.kernels) grammar.closure(kernel);
+		double closure_us = chrono::duration<double, micro>(clock::now() - start).count();
+
+		cout << left << setw(8) << levels << setw(13) << grammar.productions.size() << setw(8) << grammar.num_states() << setw(16) << build_ms << setw(14) << items << setw(18) << kernel_ms << setw(14) << kernel_items << setw(10) << cached << setw(14) << closure_us / grammar.num_states() << setw(18) << lalr_ms << setw(14) << lalr_grammar.num_states() << endl;
+	}
+}
+
+// Blank skipping and byte classification, vectorized against scalar, and
+// the whole lexer on inputs of long blank runs, single blanks and no blanks
+// at all.
+void bench_lex() {
+	typedef chrono::steady_clock clock;
+	vector<string> terminals = {"+", "*", "(", ")", "id", "$"};
+	TokenDfa dfa(terminals, {});
+	vector<pair<string, string>> inputs = {{"wide", "id" + string(62, ' ') + "+"}, {"spaced", "( id + id ) * id + "}, {"dense", "(id+id)*id+"}};
+	cout << "blank skipping and classification: " << skip_blanks_path() << endl;
+	cout << left << setw(10) << "input" << setw(10) << "tokens" << setw(20) << "scalar skip (MB/s)" << setw(20) << "vector skip (MB/s)" << setw(24) << "scalar classify (MB/s)" << setw(24) << "vector classify (MB/s)" << setw(16) << "lexer (MB/s)" << endl;
+	for (auto& [name, unit] : inputs) {
+		string text;
+		while (text.size() < (64 << 20)) text += unit;
+		auto mbps = [&](auto&& run) {
+			auto start = clock::now();
+			size_t n = run();
+			double ms = chrono::duration<double, milli>(clock::now() - start).count();
+			return make_pair(n, text.size() / 1e3 / ms);
+		};
+		// hop over every run of blanks and the byte after it
+		auto skip_all = [&](auto skip) {
+			size_t blanks = 0;
+			for (size_t i = 0; i < text.size(); i++) {
+				size_t k = skip(text.data() + i, text.size() - i);
+				blanks += k;
+				i += k;
+			}
+			return blanks;
+		};
+		auto scalar = mbps([&] { return skip_all([](const char* p, size_t n) { return skip_blanks_scalar(p, n); }); });
+		auto vector = mbps([&] { return skip_all([](const char* p, size_t n) { return skip_blanks(p, n); }); });
+		if (scalar.first != vector.first)
+			throw runtime_error("skip_blanks disagrees with skip_blanks_scalar");
+		// bitmaps of every 64 byte block, folded so none can be skipped
+		auto classify_all = [&](auto classify) {
+			size_t bits = 0;
+			for (size_t i = 0; i + 64 <= text.size(); i += 64) {
+				TokenBitmap m = classify(text.data() + i);
+				bits += popcount(m.blank) + popcount(m.single) + popcount(m.start);
+			}
+			return bits;
+		};
+		auto scalar_classify = mbps([&] { return classify_all([&](const char* p) { return dfa.classify_scalar(p, 64); }); });
+		auto vector_classify = mbps([&] { return classify_all([&](const char* p) { return dfa.classify(p, 64); }); });
+		if (scalar_classify.first != vector_classify.first)
+			throw runtime_error("classify disagrees with classify_scalar");
+		auto lexer = mbps([&] {
+			MemorySource source {text.data(), text.size()};
+			StreamLexer<MemorySource> lex(source, terminals, dfa);
+			size_t tokens = 0;
+			while (lex.next() < 5) tokens++;
+			return tokens;
+		});
+		cout << left << setw(10) << name << setw(10) << lexer.first << setw(20) << scalar.second << setw(20) << vector.second << setw(24) << scalar_classify.second << setw(24) << vector_classify.second << setw(16) << lexer.second << endl;
+	}
+}
+
+// Grammars the self test builds tables for: the E/T/F one of expr.y, calc.y
+// with its token patterns and two with nullable nonterminals. A terminal
+// lexed by a pattern is written as its sample text in the test inputs.
+struct TestGrammar {
+	string name;
+	string text;
+	map<string, string> samples;
 };
 
-int main() {
-	Grammar grammar({{"E'", "E"}, {"E", "E+T"}, {"E", "T"}, {"T", "T*F"}, {"T", "F"}, {"F", "(E)"}, {"F", "id"}});
+vector<TestGrammar> test_grammars() {
+	return {
+		{"expr.y", "%token id\n%%\nE : E '+' T | T ;\nT : T '*' F | F ;\nF : '(' E ')' | id ;\n", {}},
+		{"calc.y", "%token num /[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/\n%token ident /[A-Za-z_][A-Za-z0-9_]*/\n%%\n"
+			"expr : expr '+' term | expr '-' term | term ;\nterm : term '*' factor | term '/' factor | factor ;\n"
+			"factor : '(' expr ')' | '-' factor | num | ident ;\n", {{"num", "1.5"}, {"ident", "x"}}},
+		{"list", "%token id\n%%\nlist : list item | %empty ;\nitem : id | '(' list ')' ;\n", {}},
+		{"opt", "%token a b c\n%%\ns : x y c | '(' s ')' ;\nx : a x | %empty ;\ny : b | %empty ;\n", {}},
+	};
+}
 
-	cout << "First of non-terminals: " << endl;
-	for (auto nt : {"E", "T", "F"}) {
-		auto first_set = grammar.first(nt);
-		cout << "FIRST(" << nt << ") =  {";
-		for (auto f : first_set)
-			cout << f << ", ";
-		cout << "}\n";
+// A random sentence of the grammar as input text. Past depth 8 every
+// nonterminal takes the production with the shortest derivation.
+string random_sentence(Grammar& g, const map<string, string>& samples, mt19937& rng) {
+	// shortest derivation of every nonterminal, in terminals
+	vector<int> shortest(g.symbols.size(), INT_MAX / 2);
+	for (SymbolId t = 0; t < g.symbols.num_terminals; t++) shortest[t] = 1;
+	auto length = [&](const Production& p) {
+		int n = 0;
+		for (SymbolId x : p.rhs) n += shortest[x];
+		return n;
+	};
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto& p : g.productions)
+			if (length(p) < shortest[p.lhs]) {
+				shortest[p.lhs] = length(p);
+				changed = true;
+			}
 	}
-	cout << endl;
+	string text;
+	function<void(SymbolId, int)> derive = [&](SymbolId x, int depth) {
+		if (g.symbols.is_terminal(x)) {
+			auto it = samples.find(g.symbols.name(x));
+			text += (it != samples.end() ? it->second : g.symbols.name(x)) + " ";
+			return;
+		}
+		auto& choices = g.lhs_productions[x];
+		int p = choices[uniform_int_distribution<int>(0, choices.size() - 1)(rng)];
+		if (depth > 8)
+			for (int q : choices)
+				if (length(g.productions[q]) < length(g.productions[p])) p = q;
+		for (SymbolId y : g.productions[p].rhs) derive(y, depth + 1);
+	};
+	derive(g.productions[0].rhs[0], 0);
+	return text;
+}
+
+// Cross-checks the table builders: DirectLALR against the LALR(1) table
+// merged from the canonical collection, KernelOnly closures against the
+// stored Canonical item sets, and the CLR, minimal LR and LALR tables in
+// every parser mode on random sentences and on sentences with a token
+// dropped or added. Then checks the lexer DFA's match priorities and that
+// a table reads back the same through TableView. Prints every failed check
+// and returns how many failed.
+int self_test() {
+	int checks = 0, failures = 0;
+	auto check = [&](bool ok, const string& what) {
+		checks++;
+		if (!ok) {
+			cout << "FAILED: " << what << endl;
+			failures++;
+		}
+	};
 
-	cout << "Generated LR(1) Items: " << endl;
-	grammar.print_items();
+	mt19937 rng(2718);
+	for (auto& tg : test_grammars()) {
+		GrammarReader reader(tg.name, tg.text);
+		vector<rule> rules = reader.read();
+		Grammar canonical(rules), kernel_only(rules, Grammar::KernelOnly), direct(rules, Grammar::DirectLALR);
 
-	map<pair<int, Token>, Action*> action_map = grammar.action_map();
-	map<pair<int, string>, int> goto_map = grammar.goto_map();
+		// KernelOnly builds the same states and closes them to the same items
+		check(kernel_only.kernels == canonical.kernels && kernel_only.transitions == canonical.transitions, tg.name + ": KernelOnly states differ from Canonical");
+		for (int i = 0; i < canonical.num_states(); i++) {
+			vector<Item> a = kernel_only.state_items(i), b = canonical.item_set[i];
+			sort(a.begin(), a.end());
+			sort(b.begin(), b.end());
+			check(a == b, tg.name + ": KernelOnly closure of state " + to_string(i) + " differs from Canonical");
+		}
+		check(kernel_only.action_map() == canonical.action_map(), tg.name + ": KernelOnly ACTION differs from Canonical");
 
-	cout << "CLR Parse table :" << endl;
-	grammar.print_parse_table(action_map, goto_map);
+		// DirectLALR gives the merged LALR(1) table byte for byte
+		auto action_map = canonical.action_map();
+		auto goto_map = canonical.goto_map();
+		auto lalr_action_map = canonical.lalr_action_map(action_map);
+		auto lalr_goto_map = canonical.lalr_goto_map(goto_map);
+		auto direct_action_map = direct.action_map();
+		auto direct_goto_map = direct.goto_map();
+		ParseTable lalr = canonical.parse_table(lalr_action_map, lalr_goto_map);
+		ParseTable direct_lalr = direct.parse_table(direct_action_map, direct_goto_map);
+		check(direct_lalr.serialize() == lalr.serialize(), tg.name + ": DirectLALR table differs from the merged LALR(1) table");
 
-	auto tmp =  grammar.lalr_grouping();
-	cout << endl << "LALR Groupings from CLR Items: " << endl;
-	for (auto p : tmp) {
-		cout << p.first << " = ";
-		for (auto pt : p.second)
-			cout << pt << " ";
-		cout << endl;
+		// the table file format reads back what was written
+		for (auto& [token, pattern] : reader.token_patterns()) {
+			lalr.token_patterns.resize(lalr.num_terminals);
+			lalr.token_patterns[find(lalr.symbol_names.begin(), lalr.symbol_names.end(), token) - lalr.symbol_names.begin()] = pattern;
+		}
+		vector<uint32_t> image = lalr.serialize();
+		TableView view(image.data(), image.size() * 4);
+		CompressedTable packed = lalr.compress();
+		bool same = view.num_states == lalr.num_states && view.num_terminals == lalr.num_terminals && view.num_non_terminals == lalr.num_non_terminals && view.num_productions == lalr.productions.size();
+		for (int st = 0; same && st < lalr.num_states; st++) {
+			for (int t = 0; t < lalr.num_terminals; t++) same = same && view.action_at(st, t) == packed.action_at(st, t);
+			for (int nt = 0; nt < lalr.num_non_terminals; nt++) same = same && view.goto_at(st, nt) == packed.goto_at(st, nt);
+		}
+		for (int p = 0; same && p < lalr.productions.size(); p++)
+			same = view.production(p).lhs == lalr.productions[p].lhs && view.production(p).pop_amt == lalr.productions[p].pop_amt
+				&& vector<SymbolId>(view.rhs_begin(p), view.rhs_end(p)) == lalr.production_rhs[p];
+		for (int x = 0; same && x < lalr.symbol_names.size(); x++) same = view.symbol_name(x) == lalr.symbol_names[x];
+		for (int t = 0; same && t < lalr.num_terminals; t++) same = view.token_pattern(t) == (t < lalr.token_patterns.size() ? lalr.token_patterns[t] : "");
+		check(same, tg.name + ": TableView reads back a different table");
+		auto rejects = [&](vector<uint32_t> bytes, size_t size) {
+			try {
+				TableView(bytes.data(), size);
+			} catch (const runtime_error&) {
+				return true;
+			}
+			return false;
+		};
+		check(rejects(image, image.size() * 4 - 4), tg.name + ": truncated table accepted");
+		vector<uint32_t> corrupt = image;
+		corrupt[sizeof(TableHeader) / 4] = REDC_ACTN(lalr.productions.size()).word;
+		check(rejects(corrupt, corrupt.size() * 4), tg.name + ": table reducing by a missing production accepted");
+
+		auto minimal = canonical.minimal_lr_grouping();
+		auto minimal_action_map = canonical.merged_action_map(action_map, minimal);
+		auto minimal_goto_map = canonical.merged_goto_map(goto_map, minimal);
+		vector<ParseTable> tables = {canonical.parse_table(action_map, goto_map), canonical.parse_table(minimal_action_map, minimal_goto_map), lalr, direct_lalr};
+		vector<unique_ptr<Parser>> parsers;
+		for (auto& t : tables) {
+			for (int tt = 0; tt < t.num_terminals; tt++) t.token_patterns.push_back(reader.token_patterns().count(t.symbol_names[tt]) ? reader.token_patterns().at(t.symbol_names[tt]) : "");
+			for (auto m : {Parser::Plain, Parser::Optimized, Parser::OptimizedKeepUnits})
+				parsers.push_back(make_unique<Parser>(t, m));
+		}
+
+		// every table and mode accepts the same inputs
+		vector<string> terminals;
+		for (SymbolId t = 0; t + 1 < canonical.symbols.num_terminals; t++) {
+			auto it = tg.samples.find(canonical.symbols.name(t));
+			terminals.push_back(it != tg.samples.end() ? it->second : canonical.symbols.name(t));
+		}
+		for (int n = 0; n < 500; n++) {
+			string input = random_sentence(canonical, tg.samples, rng);
+			bool mutated = n % 2 == 1;
+			if (mutated) {
+				vector<string> words;
+				stringstream ss(input);
+				for (string w; ss >> w;) words.push_back(w);
+				size_t at = uniform_int_distribution<size_t>(0, words.size())(rng);
+				if (at < words.size() && rng() % 2) words.erase(words.begin() + at);
+				else words.insert(words.begin() + at, terminals[rng() % terminals.size()]);
+				input.clear();
+				for (auto& w : words) input += w + " ";
+			}
+			bool accepted = parsers[0]->parse(input).accepted;
+			if (!mutated) check(accepted, tg.name + ": sentence '" + input + "' rejected");
+			for (int i = 1; i < parsers.size(); i++)
+				check(parsers[i]->parse(input).accepted == accepted, tg.name + ": table " + to_string(i / 3) + " in mode " + to_string(i % 3) + " disagrees on '" + input + "'");
+		}
+	}
+
+	// longest match, then a literal over a pattern, then the lower terminal
+	// whatever order the terminals are declared in
+	for (bool keyword_first : {true, false}) {
+		vector<string> names = {"if", "ident", "=", "==", "num", "kw", "$"};
+		vector<string> patterns = {"", "[a-z]+", "", "", "[0-9]+", "fi", ""};
+		if (!keyword_first) {
+			names = {"kw", "ident", "=", "==", "num", "if", "$"};
+			patterns = {"fi", "[a-z]+", "", "", "[0-9]+", "", ""};
+		}
+		TokenDfa dfa(names, patterns);
+		auto lexes = [&](const string& text, const string& token, size_t length) {
+			int t;
+			bool live;
+			size_t n = dfa.match(text.data(), text.size(), t, live);
+			return t != -1 && names[t] == token && n == length;
+		};
+		string order = keyword_first ? " (if declared first)" : " (if declared last)";
+		check(lexes("if", "if", 2), "'if' is not the keyword" + order);
+		check(lexes("if(", "if", 2), "'if(' does not start with the keyword" + order);
+		check(lexes("iff", "ident", 3), "'iff' is not the longer ident" + order);
+		check(lexes("i", "ident", 1), "'i' is not an ident" + order);
+		check(lexes("fi", keyword_first ? "ident" : "kw", 2), "'fi' is not the lower of two patterns" + order);
+		check(lexes("==1", "==", 2), "'==' is not the longer literal" + order);
+		check(lexes("=1", "=", 1), "'=' is not a literal" + order);
+		check(lexes("123a", "num", 3), "'123a' does not start with num" + order);
+		int t;
+		bool live;
+		dfa.match("@", 1, t, live);
+		check(t == -1, "'@' matches a token" + order);
+
+		// the vector classifier agrees with the byte table
+		string bytes;
+		for (int i = 0; i < 4096; i++) bytes += " \t\n(=iz09@_\xff"[rng() % 12];
+		bool same = true;
+		for (size_t i = 0; i + 64 <= bytes.size(); i++) {
+			TokenBitmap a = dfa.classify(bytes.data() + i, 64), b = dfa.classify_scalar(bytes.data() + i, 64);
+			same = same && a.blank == b.blank && a.single == b.single && a.start == b.start;
+		}
+		check(same, "classify() differs from classify_scalar()" + order);
 	}
-	cout << endl;
 
-	map<pair<int, Token>, Action*> lalr_action_map = grammar.lalr_action_map(action_map);
-	map<pair<int, string>, int> lalr_goto_map = grammar.lalr_goto_map(goto_map);
+	cout << checks << " checks, " << failures << " failed" << endl;
+	return failures;
+}
+
+// Arithmetic for grammars like calc.y, with the action of a production
+// picked by its shape: X op Y for + - * /, ( X ) and - X. A number token is
+// its value and any other token NaN.
+SemanticActions<double> arithmetic_actions(const TableView& table) {
+	SemanticActions<double> actions;
+	actions.on_token = [](int terminal, string_view text) {
+		double value;
+		auto [end, ec] = from_chars(text.data(), text.data() + text.size(), value);
+		return ec == errc() && end == text.data() + text.size() ? value : NAN;
+	};
+	for (int p = 0; p < table.num_productions; p++) {
+		vector<string_view> rhs;
+		for (const SymbolId* x = table.rhs_begin(p); x != table.rhs_end(p); x++) rhs.push_back(table.symbol_name(*x));
+		if (rhs.size() == 3 && rhs[0] == "(" && rhs[2] == ")") {
+			actions.on(p, [](span<double> v) { return v[1]; });
+		} else if (rhs.size() == 3 && rhs[1] == "+") {
+			actions.on(p, [](span<double> v) { return v[0] + v[2]; });
+		} else if (rhs.size() == 3 && rhs[1] == "-") {
+			actions.on(p, [](span<double> v) { return v[0] - v[2]; });
+		} else if (rhs.size() == 3 && rhs[1] == "*") {
+			actions.on(p, [](span<double> v) { return v[0] * v[2]; });
+		} else if (rhs.size() == 3 && rhs[1] == "/") {
+			actions.on(p, [](span<double> v) { return v[0] / v[2]; });
+		} else if (rhs.size() == 2 && rhs[0] == "-") {
+			actions.on(p, [](span<double> v) { return -v[1]; });
+		}
+	}
+	return actions;
+}
 
-	cout << "LALR Parse table:" << endl;
-	grammar.print_parse_table(lalr_action_map, lalr_goto_map);
-	cout << endl;
+// Evaluates a line from stdin with arithmetic_actions, no tree is built.
+void read_and_evaluate(Parser& parser) {
+	string input;
+	cout << "Enter expression to evaluate :";
+	getline(cin, input);
+	double value;
+	ParseResult result = parser.evaluate(input, arithmetic_actions(parser.view()), value);
+	if (result.accepted)
+		cout << input << " = " << value << endl;
+	else
+		cout << "rejected after " << result.offset << " bytes" << endl;
+}
 
-	// Create parser
-	Parser parser(lalr_action_map, lalr_goto_map);
+// Parses a line from stdin, printing every step unless quiet.
+void read_and_parse(Parser& parser, bool quiet) {
 	string input;
 	cout << "Enter string to parse :";
 	getline(cin, input);
-	parser.parse(input);
+	if (quiet) {
+		ParseResult result = parser.parse(input);
+		const CompactTree& tree = parser.compact_tree();
+		cout << (result.accepted ? "accepted" : "rejected") << " in " << result.steps << " steps for " << result.tokens << " tokens, tree of " << tree.nodes.size() << " nodes (" << tree.nodes.size() * sizeof(CompactTree::Node) << " bytes)" << endl;
+		return;
+	}
+
+	TablePrinter printer(parser.view());
+	ParseResult result = parser.parse(input, printer);
+	Tree pt = parser.parse_tree();
+	if (result.accepted) {
+		cout << result.steps << " steps for " << result.tokens << " tokens" << endl;
+		cout << "\nThe parse tree for the string is : \n" << pt << "\n";
+	} else if (!pt.root.children.empty()) {
+		cout << "\nParsed before the error : \n" << pt << "\n";
+	}
+}
+
+// Parses a whole file (stdin for "-") through StreamLexer, mapping it
+// instead of reading it in chunks if mapped is set.
+void stream_and_parse(Parser& parser, const string& path, bool mapped) {
+	auto start = chrono::steady_clock::now();
+	ParseResult result;
+	if (mapped) {
+		MappedFile file(path);
+		MemorySource source {static_cast<const char*>(file.data()), file.size()};
+		result = parser.parse_stream(source);
+	} else if (path == "-") {
+		IstreamSource source {cin};
+		result = parser.parse_stream(source);
+	} else {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			throw runtime_error("cannot open " + path);
+		FdSource source {fd};
+		try {
+			result = parser.parse_stream(source);
+		} catch (...) {
+			close(fd);
+			throw;
+		}
+		close(fd);
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << (result.accepted ? "accepted" : "rejected") << ": " << result.tokens << " tokens, " << result.offset << " bytes in " << ms << " ms (" << result.offset / 1e3 / max(ms, 1e-3) << " MB/s)" << endl;
+}
+
+// Parses a file on a second thread and counts the productions used from
+// the events as they come out of the ring.
+void count_events(Parser& parser, const string& path) {
+	MappedFile file(path);
+	MemorySource source {static_cast<const char*>(file.data()), file.size()};
+	EventRing ring(1 << 12);
+	ParseResult result;
+	auto start = chrono::steady_clock::now();
+	thread producer([&] { result = parser.parse_events(source, ring); });
+
+	vector<uint64_t> uses(parser.view().num_productions);
+	uint64_t events = 0;
+	for (bool done = false; !done;) {
+		ParseEvent event;
+		if (!ring.pop(event)) {
+			this_thread::yield();
+			continue;
+		}
+		events++;
+		if (event.kind() == ParseEvent::Reduce) uses[event.id()]++;
+		done = event.kind() == ParseEvent::Accept || event.kind() == ParseEvent::Error;
+	}
+	producer.join();
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout << (result.accepted ? "accepted" : "rejected after " + to_string(result.offset) + " bytes") << ": " << events << " events in " << ms << " ms" << endl;
+	for (int p = 0; p < uses.size(); p++)
+		if (uses[p]) cout << right << setw(12) << uses[p] << "  " << parser.view().production_str(p) << endl;
+	cout << left;
+}
+
+// Parses every line of a file as an input of its own in one batch, on a
+// ParseService with that many threads unless threads is 0.
+void batch_and_parse(Parser& parser, const string& path, int threads) {
+	MappedFile file(path);
+	string_view text(static_cast<const char*>(file.data()), file.size());
+	vector<string_view> lines;
+	for (size_t i = 0; i < text.size();) {
+		size_t end = min(text.find('\n', i), text.size());
+		lines.push_back(text.substr(i, end - i));
+		i = end + 1;
+	}
+	vector<BatchResult> results;
+	double ms;
+	if (threads == 0) {
+		auto start = chrono::steady_clock::now();
+		results = parser.parse_batch(lines);
+		ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	} else {
+		ParseService service(parser.view(), threads, parser.parse_mode());
+		auto start = chrono::steady_clock::now();
+		results = service.parse(lines);
+		ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		cout << left << setw(8) << "thread" << setw(12) << "inputs" << setw(12) << "tokens" << setw(10) << "shards" << setw(10) << "stolen" << setw(12) << "ms" << setw(14) << "M inputs/s" << setw(10) << "MB/s" << endl;
+		for (int w = 0; w < service.threads(); w++) {
+			const auto& s = service.stats()[w];
+			cout << left << setw(8) << w << setw(12) << s.inputs << setw(12) << s.tokens << setw(10) << s.shards << setw(10) << s.stolen << setw(12) << s.ms << setw(14) << s.inputs / 1e3 / max(s.ms, 1e-3) << setw(10) << s.bytes / 1e3 / max(s.ms, 1e-3) << endl;
+		}
+	}
+
+	size_t accepted = 0, tokens = 0, shown = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		tokens += results[i].tokens;
+		if (results[i].accepted())
+			accepted++;
+		else if (shown++ < 10)
+			cout << path << ":" << i + 1 << ": rejected after " << results[i].error_at << " bytes" << endl;
+	}
+	cout << accepted << " of " << results.size() << " inputs accepted, " << tokens << " tokens in " << ms << " ms (" << results.size() / 1e3 / max(ms, 1e-3) << " M inputs/s, " << file.size() / 1e3 / max(ms, 1e-3) << " MB/s)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+	Grammar::ItemSetMode mode = Grammar::Canonical;
+	bool minimal_lr = false;
+	string grammar_path, write_path, load_path, emit_path;
+	bool switch_states = false;
+	Parser::Mode parser_mode = Parser::Plain;
+	bool quiet = false;
+	string stream_path, batch_path, events_path;
+	int threads = 0;
+	bool stream_mapped = false;
+	bool eval = false;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--bench-closure") {
+			bench_closure();
+			return 0;
+		} else if (arg == "--bench-lex") {
+			bench_lex();
+			return 0;
+		} else if (arg == "--self-test") {
+			try {
+				return self_test() == 0 ? 0 : 1;
+			} catch (const exception& e) {
+				cout << e.what() << endl;
+				return 1;
+			}
+		} else if (arg == "--kernel-only") {
+			mode = Grammar::KernelOnly;
+		} else if (arg == "--direct-lalr") {
+			mode = Grammar::DirectLALR;
+		} else if (arg == "--minimal-lr") {
+			minimal_lr = true;
+		} else if (arg == "--grammar" && i + 1 < argc) {
+			grammar_path = argv[++i];
+		} else if (arg == "--write-table" && i + 1 < argc) {
+			write_path = argv[++i];
+		} else if (arg == "--load-table" && i + 1 < argc) {
+			load_path = argv[++i];
+		} else if (arg == "--emit-cpp" && i + 1 < argc) {
+			emit_path = argv[++i];
+		} else if (arg == "--switch-states") {
+			switch_states = true;
+		} else if (arg == "--optimize") {
+			if (parser_mode == Parser::Plain) parser_mode = Parser::Optimized;
+		} else if (arg == "--keep-units") {
+			parser_mode = Parser::OptimizedKeepUnits;
+		} else if (arg == "--quiet") {
+			quiet = true;
+		} else if (arg == "--stream" && i + 1 < argc) {
+			stream_path = argv[++i];
+		} else if (arg == "--stream-mmap" && i + 1 < argc) {
+			stream_path = argv[++i];
+			stream_mapped = true;
+		} else if (arg == "--batch" && i + 1 < argc) {
+			batch_path = argv[++i];
+		} else if (arg == "--events" && i + 1 < argc) {
+			events_path = argv[++i];
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = max(atoi(argv[++i]), 0);
+		} else if (arg == "--eval") {
+			eval = true;
+		}
+	}
+
+	using clock = chrono::steady_clock;
+	auto start = clock::now();
+	if (!load_path.empty()) {
+		// parse straight from a table file, nothing gets generated
+		try {
+			MappedFile file(load_path);
+			Parser parser(TableView(file.data(), file.size()), parser_mode);
+			double map_us = chrono::duration<double, micro>(clock::now() - start).count();
+			cout << "Mapped " << load_path << " (" << file.size() << " bytes) in " << map_us << " us" << endl;
+			if (!stream_path.empty())
+				stream_and_parse(parser, stream_path, stream_mapped);
+			else if (!batch_path.empty())
+				batch_and_parse(parser, batch_path, threads);
+			else if (!events_path.empty())
+				count_events(parser, events_path);
+			else if (eval)
+				read_and_evaluate(parser);
+			else
+				read_and_parse(parser, quiet);
+		} catch (const exception& e) {
+			cout << e.what() << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	vector<rule> rules = Grammar::split_productions({{"E'", "E"}, {"E", "E+T"}, {"E", "T"}, {"T", "T*F"}, {"T", "F"}, {"F", "(E)"}, {"F", "id"}});
+	map<string, string> patterns;
+	if (!grammar_path.empty()) {
+		try {
+			rules = load_grammar(grammar_path, patterns);
+		} catch (const exception& e) {
+			cout << e.what() << endl;
+			return 1;
+		}
+	}
+	double load_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+	start = clock::now();
+	Grammar grammar(rules, mode);
+	double items_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+	// the generator's dumps, --quiet leaves only the parse
+	if (!quiet) {
+		cout << "First of non-terminals: " << endl;
+		for (SymbolId nt = grammar.symbols.num_terminals; nt < grammar.symbols.size(); nt++) {
+			if (nt == grammar.productions[0].lhs) continue;
+			set<string> first_set;
+			grammar.first_sets[nt - grammar.symbols.num_terminals].for_each([&](SymbolId f) {
+				first_set.insert(grammar.symbols.name(f));
+			});
+			cout << "FIRST(" << grammar.symbols.name(nt) << ") =  {";
+			for (auto f : first_set)
+				cout << f << ", ";
+			cout << "}" << (grammar.nullable[nt] ? " nullable" : "") << "\n";
+		}
+		cout << endl;
+
+		if (mode == Grammar::DirectLALR) {
+			cout << "Generated LALR(1) Items: " << endl;
+			grammar.print_items();
+		} else {
+			cout << "Generated LR(1) Items: " << endl;
+			grammar.print_items();
+		}
+	}
+
+	start = clock::now();
+	map<pair<int, SymbolId>, Action> action_map = grammar.action_map();
+	map<pair<int, SymbolId>, int> goto_map = grammar.goto_map();
+	map<pair<int, SymbolId>, Action> lalr_action_map = action_map;
+	map<pair<int, SymbolId>, int> lalr_goto_map = goto_map;
+	double tables_ms = chrono::duration<double, milli>(clock::now() - start).count();
+
+	if (mode != Grammar::DirectLALR) {
+		if (!quiet) {
+			cout << "CLR Parse table :" << endl;
+			grammar.print_parse_table(action_map, goto_map);
+
+			auto tmp =  grammar.lalr_grouping();
+			cout << endl << "LALR Groupings from CLR Items: " << endl;
+			for (auto p : tmp) {
+				cout << p.first << " = ";
+				for (auto pt : p.second)
+					cout << pt << " ";
+				cout << endl;
+			}
+			cout << endl;
+		}
+
+		start = clock::now();
+		lalr_action_map = grammar.lalr_action_map(action_map);
+		lalr_goto_map = grammar.lalr_goto_map(goto_map);
+		tables_ms += chrono::duration<double, milli>(clock::now() - start).count();
+	}
+
+	if (!quiet) {
+		cout << "LALR Parse table:" << endl;
+		grammar.print_parse_table(lalr_action_map, lalr_goto_map);
+		cout << endl;
+	}
+
+	// the table the parser runs on
+	map<pair<int, SymbolId>, Action> parser_action_map = lalr_action_map;
+	map<pair<int, SymbolId>, int> parser_goto_map = lalr_goto_map;
+
+	vector<pair<int, vector<int>>> states;
+	for (int i = 0; i < grammar.num_states(); i++) states.push_back({i, {i}});
+	// dense and comb-packed bytes, production info counted in both
+	auto size_row = [&](const string& name, int num_states, const ParseTable& t, int conflicts) {
+		cout << setw(16) << name << setw(8) << num_states << setw(10) << t.bytes() << setw(10) << t.compress().bytes() + t.productions.size() * sizeof(ProductionInfo) << conflicts << endl;
+	};
+	if (!quiet) {
+		cout << "Grammar " << (grammar_path.empty() ? "E/T/F (built in)" : grammar_path) << ": " << grammar.productions.size() << " productions, " << grammar.symbols.num_terminals << " terminals, " << grammar.symbols.num_non_terminals() << " nonterminals" << endl;
+		cout << "loaded in " << load_ms << " ms, item sets built in " << items_ms << " ms, tables built in " << tables_ms << " ms" << endl << endl;
+		cout << "Table sizes: " << endl;
+		cout << left << setw(16) << "mode" << setw(8) << "states" << setw(10) << "bytes" << setw(10) << "packed" << "conflicts" << endl;
+	}
+	if (mode == Grammar::DirectLALR) {
+		if (!quiet) size_row("LALR(1)", grammar.num_states(), grammar.parse_table(lalr_action_map, lalr_goto_map), grammar.count_conflicts(states));
+	} else {
+		auto minimal = grammar.minimal_lr_grouping();
+		auto minimal_action_map = grammar.merged_action_map(action_map, minimal);
+		auto minimal_goto_map = grammar.merged_goto_map(goto_map, minimal);
+		if (!quiet) {
+			auto lalr = grammar.lalr_grouping();
+			size_row("CLR(1)", states.size(), grammar.parse_table(action_map, goto_map), grammar.count_conflicts(states));
+			size_row("minimal LR(1)", minimal.size(), grammar.parse_table(minimal_action_map, minimal_goto_map), grammar.count_conflicts(minimal));
+			size_row("LALR(1)", lalr.size(), grammar.parse_table(lalr_action_map, lalr_goto_map), grammar.count_conflicts(lalr));
+		}
+		if (minimal_lr) {
+			parser_action_map = minimal_action_map;
+			parser_goto_map = minimal_goto_map;
+			if (!quiet) {
+				cout << endl << "Minimal LR(1) Parse table:" << endl;
+				grammar.print_parse_table(minimal_action_map, minimal_goto_map);
+			}
+		}
+	}
+	cout << right;
+	if (!quiet) cout << endl;
+
+	ParseTable table = grammar.parse_table(parser_action_map, parser_goto_map);
+	// the tables are built, only kernels need to outlive them
+	grammar.clear_closure_cache();
+	for (int t = 0; t < table.num_terminals; t++) {
+		auto it = patterns.find(table.symbol_names[t]);
+		table.token_patterns.push_back(it != patterns.end() ? it->second : "");
+	}
+	try {
+		TokenDfa dfa = table.token_dfa();
+		if (!quiet) cout << "Lexer DFA: " << dfa.num_states() << " states, " << dfa.num_classes << " byte classes" << endl << endl;
+	} catch (const exception& e) {
+		cout << e.what() << endl;
+		return 1;
+	}
+	if (!write_path.empty()) {
+		try {
+			write_table(table, write_path);
+		} catch (const exception& e) {
+			cout << e.what() << endl;
+			return 1;
+		}
+		cout << "Wrote " << write_path << " (" << table.serialize().size() * 4 << " bytes)" << endl << endl;
+	}
+	if (!emit_path.empty()) {
+		// the namespace is named after the file, expr_parser.h gives expr_parser
+		string stem = emit_path.substr(emit_path.find_last_of('/') + 1);
+		stem = cpp_identifier(stem.substr(0, stem.find('.')));
+		if (stem.empty() || isdigit(static_cast<unsigned char>(stem[0]))) stem = "_" + stem;
+		ofstream out(emit_path);
+		emit_cpp(table, out, stem, switch_states);
+		if (!out) {
+			cout << "cannot write " << emit_path << endl;
+			return 1;
+		}
+		cout << "Wrote " << emit_path << " (namespace " << stem << ")" << endl << endl;
+	}
+
+	// Create parser
+	Parser parser(table, parser_mode);
+	if (stream_path.empty() && batch_path.empty() && events_path.empty()) {
+		if (eval)
+			read_and_evaluate(parser);
+		else
+			read_and_parse(parser, quiet);
+		return 0;
+	}
+	try {
+		if (!stream_path.empty())
+			stream_and_parse(parser, stream_path, stream_mapped);
+		else if (!batch_path.empty())
+			batch_and_parse(parser, batch_path, threads);
+		else
+			count_events(parser, events_path);
+	} catch (const exception& e) {
+		cout << e.what() << endl;
+		return 1;
+	}
 }